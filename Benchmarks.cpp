@@ -0,0 +1,480 @@
+/*
+  ==============================================================================
+
+    Benchmarks.cpp
+    Timing and quality measurements for the DSP code. The figures quoted in
+    the headers come from here, so rerun the section after changing the code
+    it covers.
+
+    Usage: FlexDelayBenchmarks [section ...]
+
+    With no arguments every section runs. Build in Release - numbers from an
+    unoptimised build mean nothing.
+
+  ==============================================================================
+*/
+
+#include "DelayBank.h"
+#include "DelayLine.h"
+#include "Interpolation.h"
+#include "Kernels.h"
+#include "StereoDelayElement.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const double PI = std::acos(-1.0);
+
+    // Somewhere for results to go, so the optimiser can't drop the work.
+    volatile double sink = 0.0;
+
+    void consume(const double* samples, size_t count) {
+        if (count > 0) sink = sink + samples[count / 2];
+    }
+
+    double seconds_since(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // The kernel levels this machine can run. Each timing below is taken
+    // once per level.
+    std::vector<KernelLevel> runnable_levels() {
+        std::vector<KernelLevel> levels { KernelLevel::SCALAR };
+
+#if FLEXDELAY_X86_KERNELS && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        bool has[KERNEL_LEVEL_COUNT] = {
+            true,
+            __builtin_cpu_supports("sse4.1") != 0,
+            __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"),
+            __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl"),
+        };
+
+        for (int i = 1; i < KERNEL_LEVEL_COUNT; ++i) {
+            if (has[i] && select_kernels(KernelLevel(i)) == KernelLevel(i)) {
+                levels.push_back(KernelLevel(i));
+            }
+        }
+#endif
+
+        select_kernels(KernelLevel::SCALAR);
+        return levels;
+    }
+
+    //==============================================================================
+    // quality - the interpolation tiers (Interpolation.h).
+    //
+    // Each tier resamples a sine by 1.3x, the largest step StereoDelayElement
+    // takes in one block, in the direction that raises the pitch. The
+    // frequency is picked so that the measured stretch of the output holds a
+    // whole number of cycles, so the ideal output is exactly one sine and
+    // anything else - harmonics, images, aliases, noise - is error. THD+N is
+    // that error's energy relative to the sine. The ends of the output are
+    // left out of the measurement, since there the kernels clamp their taps.
+
+    double thd_n_db(InterpolationQuality q, double out_hz, double sample_rate) {
+        constexpr size_t MEASURED = 8192;
+        constexpr size_t MARGIN = 64;
+
+        const size_t new_size = MEASURED + 2 * MARGIN;
+        const auto old_size = size_t(std::lround(1.3 * double(new_size - 1))) + 1;
+
+        auto cycles = std::max(1.0, std::round(out_hz / sample_rate * double(MEASURED)));
+        auto w_out = 2.0 * PI * cycles / double(MEASURED);
+        auto w_in = w_out * double(new_size - 1) / double(old_size - 1);
+
+        std::vector<double> src(old_size), dst(new_size);
+        for (size_t i = 0; i < old_size; ++i) {
+            src[i] = std::sin(w_in * double(i));
+        }
+
+        resample(q, src.data(), old_size, dst.data(), new_size);
+
+        // Fit the sine, then measure what is left over.
+        double a = 0.0, b = 0.0;
+        for (size_t n = MARGIN; n < MARGIN + MEASURED; ++n) {
+            a += dst[n] * std::sin(w_out * double(n));
+            b += dst[n] * std::cos(w_out * double(n));
+        }
+        a *= 2.0 / double(MEASURED);
+        b *= 2.0 / double(MEASURED);
+
+        double residual = 0.0;
+        for (size_t n = MARGIN; n < MARGIN + MEASURED; ++n) {
+            auto e = dst[n] - (a * std::sin(w_out * double(n)) + b * std::cos(w_out * double(n)));
+            residual += e * e;
+        }
+
+        auto fundamental = 0.5 * (a * a + b * b) * double(MEASURED);
+        return 10.0 * std::log10(std::max(residual, 1e-30) / fundamental);
+    }
+
+    // Nanoseconds per output sample for 512 sample blocks, best of five.
+    double resample_ns(InterpolationQuality q) {
+        constexpr size_t NEW_SIZE = 512;
+        constexpr size_t OLD_SIZE = 666;
+        constexpr int BLOCKS = 4000;
+
+        std::vector<double> src(OLD_SIZE), dst(NEW_SIZE);
+        for (size_t i = 0; i < OLD_SIZE; ++i) {
+            src[i] = std::sin(double(i) * 0.01);
+        }
+
+        auto best = 1e30;
+        for (int run = 0; run < 5; ++run) {
+            auto start = Clock::now();
+            for (int b = 0; b < BLOCKS; ++b) {
+                resample(q, src.data(), OLD_SIZE, dst.data(), NEW_SIZE);
+                consume(dst.data(), NEW_SIZE);
+            }
+            best = std::min(best, seconds_since(start));
+        }
+        return best * 1e9 / (double(BLOCKS) * double(NEW_SIZE));
+    }
+
+    void quality() {
+        const double sample_rate = 44100.0;
+        const double frequencies[] = { 1000.0, 10000.0, 18000.0 };
+
+        std::printf("THD+N after a 1.3x resample (%.1f kHz), and ns per output sample\n\n", sample_rate / 1000.0);
+        std::printf("%-10s", "tier");
+        for (auto hz : frequencies) std::printf("  %5.0f Hz", hz);
+
+        auto levels = runnable_levels();
+        for (auto level : levels) std::printf("  %8s", kernel_level_name(level));
+        std::printf("\n");
+
+        for (int i = 0; i < INTERPOLATION_QUALITY_COUNT; ++i) {
+            auto q = InterpolationQuality(i);
+            std::printf("%-10s", interpolation_quality_name(q));
+
+            select_kernels(KernelLevel::SCALAR);
+            for (auto hz : frequencies) std::printf("  %5.0f dB", thd_n_db(q, hz, sample_rate));
+
+            for (auto level : levels) {
+                select_kernels(level);
+                std::printf("  %8.1f", resample_ns(q));
+            }
+            std::printf("\n");
+        }
+
+        select_kernels(KernelLevel::SCALAR);
+    }
+
+    //==============================================================================
+    // bandwidth - DelayLine's steady path (process_block).
+    //
+    // With the delay steady, a block is at most two copies out of the line
+    // and two copies in. Once the line is much bigger than the last level
+    // cache every one of those samples comes from and goes back to DRAM, so
+    // the path should run at the speed of memcpy. The big line here is
+    // 512 MB, bigger than any last level cache we have seen; the small one
+    // (2 s at 44.1kHz) fits in L2 for comparison. Traffic counts the line
+    // only - 8 bytes read and 8 written per sample.
+
+    constexpr size_t BIG_LINE = size_t(1) << 26;
+
+    double copy_gb_per_sec() {
+        std::unique_ptr<double[]> a(new double[BIG_LINE]);
+        std::unique_ptr<double[]> b(new double[BIG_LINE]);
+        std::fill(a.get(), a.get() + BIG_LINE, 1.0);
+        std::fill(b.get(), b.get() + BIG_LINE, 0.0);
+
+        auto best = 1e30;
+        for (int run = 0; run < 3; ++run) {
+            auto start = Clock::now();
+            std::memcpy(b.get(), a.get(), BIG_LINE * sizeof(double));
+            best = std::min(best, seconds_since(start));
+            consume(b.get(), BIG_LINE);
+        }
+        return 2.0 * double(BIG_LINE * sizeof(double)) / best * 1e-9;
+    }
+
+    void bandwidth() {
+        constexpr size_t BLOCK = 4096;
+        const size_t lengths[] = { 88200, BIG_LINE };
+
+        std::printf("memcpy, %zu MB: %.1f GB/s\n\n", BIG_LINE * sizeof(double) >> 20, copy_gb_per_sec());
+        std::printf("%12s  %12s  %14s  %10s\n", "line", "block", "ns/sample", "GB/s");
+
+        std::vector<double> in(BLOCK), out(BLOCK);
+        for (size_t i = 0; i < BLOCK; ++i) {
+            in[i] = std::sin(double(i) * 0.01);
+        }
+
+        for (auto length : lengths) {
+            DelayLine line(length);
+
+            // Go round the whole line at least three times, so the big one
+            // can't be served from cache.
+            auto blocks = std::max<size_t>(3 * length / BLOCK, 2000);
+
+            auto best = 1e30;
+            for (int run = 0; run < 3; ++run) {
+                auto start = Clock::now();
+                for (size_t b = 0; b < blocks; ++b) {
+                    line.process_block(in.data(), out.data(), BLOCK);
+                    consume(out.data(), BLOCK);
+                }
+                best = std::min(best, seconds_since(start));
+            }
+
+            auto samples = double(blocks) * double(BLOCK);
+            std::printf("%12zu  %12zu  %14.3f  %10.1f\n", length, BLOCK,
+                best * 1e9 / samples, 2.0 * sizeof(double) * samples / best * 1e-9);
+        }
+    }
+
+    //==============================================================================
+    // prepare - what StereoDelayElement::prepare costs, which is most of
+    // prepareToPlay. The lines are full of audio at the longest delay the
+    // editor offers, and the host then re-prepares at the same rate or
+    // switches between 48 and 96kHz. A rate change resamples both lines with
+    // the chosen tier, so that is where the time goes. Best of five, in ms.
+
+    void fill_lines(StereoDelayElement& element, double sample_rate, int block) {
+        std::vector<double> in(static_cast<size_t>(block)), out(static_cast<size_t>(block));
+        auto blocks = int(sample_rate * StereoDelayElement::MAX_DELAY_MSEC * 0.001) / block + 1;
+
+        for (int b = 0; b < blocks; ++b) {
+            for (int i = 0; i < block; ++i) {
+                in[size_t(i)] = std::sin(0.01 * double(b * block + i));
+            }
+            for (int channel = 0; channel < 2; ++channel) {
+                element.do_delay(channel, in.data(), out.data(), size_t(block));
+            }
+        }
+    }
+
+    double prepare_ms(InterpolationQuality q, double from_rate, double to_rate) {
+        constexpr int BLOCK = 512;
+
+        auto best = 1e30;
+        for (int run = 0; run < 5; ++run) {
+            StereoDelayElement element;
+            element.set_interpolation(q);
+            element.change_delay(StereoDelayElement::MAX_DELAY_MSEC);
+            element.prepare(from_rate, BLOCK);
+            fill_lines(element, from_rate, BLOCK);
+
+            auto start = Clock::now();
+            element.prepare(to_rate, BLOCK);
+            best = std::min(best, seconds_since(start));
+        }
+        return best * 1000.0;
+    }
+
+    void prepare() {
+        std::printf("StereoDelayElement::prepare, %.0f ms of audio in each line, ms\n\n", StereoDelayElement::MAX_DELAY_MSEC);
+        std::printf("%-10s  %12s  %12s  %12s\n", "tier", "same rate", "96k -> 48k", "48k -> 96k");
+
+        for (int i = 0; i < INTERPOLATION_QUALITY_COUNT; ++i) {
+            auto q = InterpolationQuality(i);
+            std::printf("%-10s  %12.3f  %12.3f  %12.3f\n", interpolation_quality_name(q),
+                prepare_ms(q, 48000.0, 48000.0), prepare_ms(q, 96000.0, 48000.0), prepare_ms(q, 48000.0, 96000.0));
+        }
+    }
+
+    //==============================================================================
+    // bank - DelayBank against one DelayLine per voice, for the 64-256
+    // voice engines it is meant for. Random whole-sample delays in two
+    // ranges, the same for both. Blocks are process() against
+    // process_block(); ticks are tick() against get_next() and add() on
+    // each line. ns per line per sample, best of five.
+
+    struct BankCase {
+        size_t lines;
+        size_t shortest;
+        size_t longest;
+    };
+
+    template <typename Run>
+    double ns_per_line_sample(size_t lines, size_t samples, Run&& run) {
+        constexpr int REPEATS = 200;
+
+        auto best = 1e30;
+        for (int r = 0; r < 5; ++r) {
+            auto start = Clock::now();
+            for (int i = 0; i < REPEATS; ++i) run();
+            best = std::min(best, seconds_since(start));
+        }
+        return best * 1e9 / (double(REPEATS) * double(samples) * double(lines));
+    }
+
+    void bank() {
+        constexpr size_t BLOCK = 256;
+        const BankCase cases[] = {
+            { 64, 16, 256 }, { 128, 16, 256 }, { 256, 16, 256 },
+            { 64, 50, 2000 }, { 128, 50, 2000 }, { 256, 50, 2000 },
+        };
+
+        std::printf("ns per line per sample, %zu sample blocks\n\n", BLOCK);
+        std::printf("%6s  %12s  %10s  %10s  %10s  %10s\n", "lines", "delays", "block bank", "DelayLine", "tick bank", "DelayLine");
+
+        for (auto& c : cases) {
+            std::mt19937 random(1);
+            DelayBank delays;
+            delays.prepare(c.lines, c.longest, BLOCK);
+
+            std::vector<std::unique_ptr<DelayLine>> voices;
+            std::vector<std::vector<double>> in(c.lines), out(c.lines);
+            std::vector<const double*> in_ptrs;
+            std::vector<double*> out_ptrs;
+
+            for (size_t k = 0; k < c.lines; ++k) {
+                auto d = c.shortest + random() % (c.longest - c.shortest + 1);
+                delays.set_delay(k, double(d));
+                voices.push_back(std::make_unique<DelayLine>(d));
+                voices.back()->prepare(BLOCK);
+
+                in[k].resize(BLOCK);
+                out[k].resize(BLOCK);
+                for (size_t i = 0; i < BLOCK; ++i) {
+                    in[k][i] = std::sin(0.001 * double(i * (k + 1)));
+                }
+                in_ptrs.push_back(in[k].data());
+                out_ptrs.push_back(out[k].data());
+            }
+
+            auto block_bank = ns_per_line_sample(c.lines, BLOCK, [&] {
+                delays.process(in_ptrs.data(), out_ptrs.data(), BLOCK);
+                consume(out_ptrs[0], BLOCK);
+            });
+            auto block_lines = ns_per_line_sample(c.lines, BLOCK, [&] {
+                for (size_t k = 0; k < c.lines; ++k) {
+                    voices[k]->process_block(in_ptrs[k], out_ptrs[k], BLOCK);
+                }
+                consume(out_ptrs[0], BLOCK);
+            });
+
+            std::vector<double> frame_in(c.lines, 0.5), frame_out(c.lines);
+            auto tick_bank = ns_per_line_sample(c.lines, BLOCK, [&] {
+                for (size_t i = 0; i < BLOCK; ++i) {
+                    delays.tick(frame_in.data(), frame_out.data());
+                }
+                consume(frame_out.data(), c.lines);
+            });
+            auto tick_lines = ns_per_line_sample(c.lines, BLOCK, [&] {
+                for (size_t i = 0; i < BLOCK; ++i) {
+                    for (size_t k = 0; k < c.lines; ++k) {
+                        frame_out[k] = voices[k]->get_next();
+                        voices[k]->add(frame_in[k]);
+                    }
+                }
+                consume(frame_out.data(), c.lines);
+            });
+
+            std::printf("%6zu  %5zu-%-6zu  %10.2f  %10.2f  %10.2f  %10.2f\n", c.lines, c.shortest, c.longest,
+                block_bank, block_lines, tick_bank, tick_lines);
+        }
+    }
+
+    //==============================================================================
+    // mix - the steady stereo mix in processBlock. Two calls of the mono
+    // kernel, which is what mix<2, false> did, against the stereo kernel
+    // that does both channels in one pass. ns per stereo sample, best of
+    // five.
+
+    template <typename Run>
+    double mix_ns(size_t num_samples, Run&& run) {
+        constexpr int BLOCKS = 20000;
+
+        auto best = 1e30;
+        for (int r = 0; r < 5; ++r) {
+            auto start = Clock::now();
+            for (int b = 0; b < BLOCKS; ++b) run();
+            best = std::min(best, seconds_since(start));
+        }
+        return best * 1e9 / (double(BLOCKS) * double(num_samples));
+    }
+
+    void mix() {
+        const size_t sizes[] = { 64, 512 };
+        const double wet_level = 0.5, dry_level = 0.5, scale = 0.9;
+
+        std::printf("%-8s  %6s  %12s  %8s\n", "kernels", "block", "2 x mono", "stereo");
+
+        for (auto level : runnable_levels()) {
+            select_kernels(level);
+
+            for (auto n : sizes) {
+                std::vector<double> wet_left(n), wet_right(n);
+                std::vector<float> left(n), right(n);
+                for (size_t i = 0; i < n; ++i) {
+                    wet_left[i] = std::sin(0.01 * double(i));
+                    wet_right[i] = std::cos(0.01 * double(i));
+                    left[i] = float(wet_right[i]);
+                    right[i] = float(wet_left[i]);
+                }
+
+                // The level and scale keep the samples bounded over many
+                // passes, so nothing turns denormal.
+                auto mono = mix_ns(n, [&] {
+                    mix_block(wet_left.data(), left.data(), n, wet_level, dry_level, scale);
+                    mix_block(wet_right.data(), right.data(), n, wet_level, dry_level, scale);
+                    sink = sink + double(left[n / 2]);
+                });
+                auto stereo = mix_ns(n, [&] {
+                    mix_block_stereo(wet_left.data(), wet_right.data(), left.data(), right.data(),
+                        n, wet_level, dry_level, scale);
+                    sink = sink + double(left[n / 2]);
+                });
+
+                std::printf("%-8s  %6zu  %12.2f  %8.2f\n", kernel_level_name(level), n, mono, stereo);
+            }
+        }
+
+        select_kernels(KernelLevel::SCALAR);
+    }
+
+    //==============================================================================
+    struct Section {
+        const char* name;
+        void (*run)();
+    };
+
+    const Section sections[] = {
+        { "quality", quality },
+        { "bandwidth", bandwidth },
+        { "prepare", prepare },
+        { "bank", bank },
+        { "mix", mix },
+    };
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<const Section*> chosen;
+
+    for (int i = 1; i < argc; ++i) {
+        auto* found = std::find_if(std::begin(sections), std::end(sections),
+            [&](const Section& s) { return std::strcmp(s.name, argv[i]) == 0; });
+
+        if (found == std::end(sections)) {
+            std::printf("usage: %s [section ...]\nsections:", argv[0]);
+            for (auto& s : sections) std::printf(" %s", s.name);
+            std::printf("\n");
+            return 1;
+        }
+        chosen.push_back(found);
+    }
+
+    if (chosen.empty()) {
+        for (auto& s : sections) chosen.push_back(&s);
+    }
+
+    for (auto* s : chosen) {
+        std::printf("== %s\n", s->name);
+        s->run();
+        std::printf("\n");
+    }
+    return 0;
+}
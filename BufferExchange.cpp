@@ -0,0 +1,151 @@
+/*
+  ==============================================================================
+
+    BufferExchange.cpp
+    Lets a DelayLine get a bigger buffer without allocating or freeing on
+    the audio thread.
+
+  ==============================================================================
+*/
+
+#include "BufferExchange.h"
+
+#include <chrono>
+
+
+BufferExchange::~BufferExchange() {
+    delete pending_.exchange(nullptr);
+    delete retired_.exchange(nullptr);
+    delete[] retired_data_.exchange(nullptr);
+}
+
+void BufferExchange::flag_work() {
+    if (allocator_ != nullptr) allocator_->wake();
+}
+
+void BufferExchange::request(size_t min_size) {
+    // Only the audio thread raises the request; the allocator only clears it.
+    if (min_size > requested_.load()) {
+        requested_.store(min_size);
+        flag_work();
+    }
+}
+
+std::unique_ptr<double[]> BufferExchange::take(size_t min_size, size_t& size) {
+
+    // The last ones haven't been cleaned up yet. Wait for the allocator to
+    // get to them so that there is somewhere to put what we are replacing.
+    if (retired_.load() != nullptr || retired_data_.load() != nullptr) return nullptr;
+
+    auto* p = pending_.exchange(nullptr);
+    if (p == nullptr) return nullptr;
+    pending_size_.store(0);
+
+    // p is ours now. Empty it and give the shell straight back.
+    std::unique_ptr<double[]> data;
+    if (p->size >= min_size) {
+        data = std::move(p->data);
+        size = p->size;
+    }
+    else {
+        request(min_size);
+    }
+
+    retired_.store(p);
+    flag_work();
+    return data;
+}
+
+bool BufferExchange::ready(size_t min_size) const {
+    return retired_.load() == nullptr
+        && retired_data_.load() == nullptr
+        && pending_.load() != nullptr
+        && pending_size_.load() >= min_size;
+}
+
+void BufferExchange::retire(std::unique_ptr<double[]> old) {
+    retired_data_.store(old.release());
+    flag_work();
+}
+
+bool BufferExchange::service() {
+    bool did_work = false;
+
+    if (auto* r = retired_.exchange(nullptr)) {
+        delete r;
+        did_work = true;
+    }
+    if (auto* d = retired_data_.exchange(nullptr)) {
+        delete[] d;
+        did_work = true;
+    }
+
+    auto want = requested_.load();
+    if (want == 0) return did_work;
+
+    // Don't look inside pending_ - see the class comment.
+    if (pending_.load() == nullptr || pending_size_.load() < want) {
+        auto* a = new Allocation;
+        a->data = std::make_unique<double[]>(want);
+        a->size = want;
+
+        // Zero the size first, so that while the two disagree ready() says
+        // no rather than yes.
+        pending_size_.store(0);
+        delete pending_.exchange(a);
+        pending_size_.store(want);
+        did_work = true;
+    }
+
+    // If the audio thread asked for more in the meantime, leave it for the
+    // next pass.
+    requested_.compare_exchange_strong(want, 0);
+
+    return did_work;
+}
+
+BufferAllocator::~BufferAllocator() {
+    stop();
+}
+
+void BufferAllocator::watch(BufferExchange& exchange) {
+    exchange.allocator_ = this;
+    exchanges_.push_back(&exchange);
+}
+
+void BufferAllocator::start() {
+    if (thread_.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = true;
+    }
+    thread_ = std::thread([this] { run(); });
+}
+
+void BufferAllocator::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    stopping_.notify_one();
+    if (thread_.joinable()) thread_.join();
+}
+
+void BufferAllocator::run() {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stopping_.wait_for(lock, std::chrono::milliseconds(POLL_MSEC), [this] { return !running_; });
+            if (!running_) return;
+        }
+
+        // Anything the audio thread asks for while this runs sets work_
+        // again, so it gets another pass.
+        if (!work_.exchange(false)) continue;
+
+        for (auto* e : exchanges_) {
+            e->service();
+        }
+    }
+}
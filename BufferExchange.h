@@ -0,0 +1,127 @@
+/*
+  ==============================================================================
+
+    BufferExchange.h
+    Lets a DelayLine get a bigger buffer without allocating or freeing on
+    the audio thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class BufferAllocator;
+
+// The hand-off point between one DelayLine (on the audio thread) and the
+// BufferAllocator (on a background thread).
+//
+// The audio thread asks for a size with request(). The allocator builds a
+// zeroed buffer at least that big and publishes it in `pending`. The audio
+// thread picks it up with take(), moves its samples across, and hands the
+// old storage back through retire(). request(), take() and retire() flag
+// the allocator, which frees what was handed back on its next pass.
+//
+// Once the allocator has published an Allocation it never looks inside it
+// again - the audio thread may have taken it. It goes by pending_size_
+// instead, and only deletes what it has got back with an exchange. The
+// audio thread empties what it takes and returns the shell through retired_,
+// and the old storage separately through retired_data_, so nothing it
+// writes to is ever shared.
+//
+// The audio thread is the only reader of a delay line's storage. Once it
+// has retired a buffer it never touches it again, so retirement is the end
+// of the grace period and no further epoch tracking is needed.
+class BufferExchange {
+public:
+    struct Allocation {
+        std::unique_ptr<double[]> data;
+        size_t size = 0;
+    };
+
+    BufferExchange() = default;
+    ~BufferExchange();
+
+    // Audio thread. None of these allocate, free, lock or wait.
+    void request(size_t min_size);
+
+    // A buffer of at least min_size samples, and its size, or null if there
+    // isn't one yet (then it is asked for).
+    std::unique_ptr<double[]> take(size_t min_size, size_t& size);
+
+    // Storage the audio thread has finished with, for the allocator to free.
+    void retire(std::unique_ptr<double[]> old);
+
+    // Audio thread. True if take(min_size) would succeed now. Only the audio
+    // thread takes, and the allocator only ever swaps in a bigger buffer, so
+    // it still will when the caller gets round to it.
+    bool ready(size_t min_size) const;
+
+    // Allocator thread. Returns true if it did anything.
+    bool service();
+
+private:
+    friend class BufferAllocator;
+
+    // Set by BufferAllocator::watch(), and flagged when there is work.
+    BufferAllocator* allocator_ = nullptr;
+
+    std::atomic<size_t> requested_ { 0 };
+    std::atomic<Allocation*> pending_ { nullptr };
+    std::atomic<Allocation*> retired_ { nullptr };
+    std::atomic<double*> retired_data_ { nullptr };
+
+    // The size of what is in pending_. The allocator zeroes it, publishes a
+    // buffer and then sets it, and the audio thread zeroes it when it takes
+    // one, so it can be behind pending_ but never claims more than is there.
+    std::atomic<size_t> pending_size_ { 0 };
+
+    void flag_work();
+
+    BufferExchange(const BufferExchange&) = delete;
+    BufferExchange& operator=(const BufferExchange&) = delete;
+};
+
+// Background thread that services a fixed set of exchanges.
+//
+// The audio thread can't take a lock or signal a condition variable - both
+// can block on the allocator thread - so wake() only sets a flag, and the
+// allocator looks at it every POLL_MSEC. A line only grows past what
+// prepare() reserved when the delay goes past StereoDelayElement's range,
+// so the wait is rare. Idle, that is a hundred wake-ups a second that each
+// read one atomic.
+class BufferAllocator {
+public:
+    BufferAllocator() = default;
+    ~BufferAllocator();
+
+    // Must all be added before start().
+    void watch(BufferExchange& exchange);
+
+    void start();
+    void stop();
+
+    // Called by the exchanges, on the audio thread. Never blocks.
+    void wake() { work_.store(true); }
+
+private:
+    static constexpr int POLL_MSEC = 10;
+
+    std::vector<BufferExchange*> exchanges_;
+    std::thread thread_;
+
+    // Only for start() and stop(), which are on the message thread.
+    std::mutex mutex_;
+    std::condition_variable stopping_;
+    bool running_ = false;
+
+    std::atomic<bool> work_ { false };
+
+    void run();
+};
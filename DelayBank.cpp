@@ -0,0 +1,166 @@
+/*
+  ==============================================================================
+
+    DelayBank.cpp
+    Many short, independent delay lines run side by side - one per voice,
+    say - with all their samples in one slab.
+
+  ==============================================================================
+*/
+
+#include "DelayBank.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+void DelayBank::prepare(size_t line_count, size_t max_delay, size_t max_block) {
+    line_count_ = line_count;
+    max_delay_ = max_delay;
+    max_block_ = std::max<size_t>(max_block, 1);
+    stride_ = max_delay_ + max_block_ + 1;
+    write_pos_ = 0;
+
+    slab_.assign(stride_ * line_count, 0.0);
+
+    delay_.assign(line_count, 0.0);
+    target_.assign(line_count, 0.0);
+    whole_.assign(line_count, 0);
+    fraction_.assign(line_count, 0.0);
+}
+
+void DelayBank::set_delay(size_t line, double samples) {
+    assert(line < line_count_);
+
+    samples = std::clamp(samples, 0.0, double(max_delay_));
+    delay_[line] = samples;
+    target_[line] = samples;
+    set_offset(line);
+}
+
+void DelayBank::change_delay(size_t line, double samples) {
+    assert(line < line_count_);
+
+    target_[line] = std::clamp(samples, 0.0, double(max_delay_));
+}
+
+void DelayBank::set_offset(size_t k) {
+    whole_[k] = size_t(delay_[k]);
+    fraction_[k] = delay_[k] - double(whole_[k]);
+}
+
+void DelayBank::clear() {
+    std::fill(slab_.begin(), slab_.end(), 0.0);
+}
+
+void DelayBank::clear(size_t line) {
+    auto* start = slab_.data() + line * stride_;
+    std::fill(start, start + stride_, 0.0);
+}
+
+void DelayBank::process(const double* const* in, double* const* out, size_t num_samples) {
+    assert(num_samples <= max_block_);
+
+    for (size_t k = 0; k < line_count_; ++k) {
+        auto* line = slab_.data() + k * stride_;
+
+        // Write the whole block first, so that in and out can be the same
+        // and a delay shorter than the block reads what was just written.
+        write(line, in[k], num_samples);
+
+        if (delay_[k] != target_[k]) {
+            read_gliding(k, line, out[k], num_samples);
+        }
+        else {
+            auto start = wrap(write_pos_ + stride_ - whole_[k]);
+            read(line, start, fraction_[k], out[k], num_samples);
+        }
+    }
+
+    write_pos_ = (write_pos_ + num_samples) % stride_;
+}
+
+void DelayBank::tick(const double* in, double* out) {
+
+    for (size_t k = 0; k < line_count_; ++k) {
+        auto* line = slab_.data() + k * stride_;
+        line[write_pos_] = in[k];
+
+        if (delay_[k] != target_[k]) {
+            read_gliding(k, line, out + k, 1);
+        }
+        else {
+            auto newer = wrap(write_pos_ + stride_ - whole_[k]);
+            auto older = (newer == 0) ? stride_ - 1 : newer - 1;
+            out[k] = line[newer] + fraction_[k] * (line[older] - line[newer]);
+        }
+    }
+
+    write_pos_ = wrap(write_pos_ + 1);
+}
+
+void DelayBank::write(double* line, const double* src, size_t num_samples) {
+    auto first = std::min(num_samples, stride_ - write_pos_);
+    std::copy(src, src + first, line + write_pos_);
+    std::copy(src + first, src + num_samples, line);
+}
+
+void DelayBank::read(const double* line, size_t start, double frac, double* dest, size_t num_samples) {
+
+    if (frac == 0.0) {
+        auto first = std::min(num_samples, stride_ - start);
+        std::copy(line + start, line + start + first, dest);
+        std::copy(line, line + (num_samples - first), dest + first);
+        return;
+    }
+
+    // Between each sample and the one before it. Split at the wrap so that
+    // each run is a plain loop over contiguous samples.
+    size_t i = 0;
+    auto pos = start;
+    while (i < num_samples) {
+        if (pos == 0) {
+            dest[i] = line[0] + frac * (line[stride_ - 1] - line[0]);
+            ++i;
+            pos = 1;
+            continue;
+        }
+
+        auto run = std::min(num_samples - i, stride_ - pos);
+        const auto* newer = line + pos;
+        auto* d = dest + i;
+        for (size_t j = 0; j < run; ++j) {
+            d[j] = newer[j] + frac * (newer[j - 1] - newer[j]);
+        }
+
+        i += run;
+        pos = wrap(pos + run);
+    }
+}
+
+void DelayBank::read_gliding(size_t k, const double* line, double* dest, size_t num_samples) {
+
+    auto delay = delay_[k];
+    auto target = target_[k];
+    auto rate = glide_rate_;
+    auto w = write_pos_;
+
+    for (size_t i = 0; i < num_samples; ++i) {
+        delay += std::clamp(target - delay, -rate, rate);
+
+        auto whole = size_t(delay);
+        auto frac = delay - double(whole);
+
+        auto newer = wrap(w + stride_ - whole);
+        auto older = (newer == 0) ? stride_ - 1 : newer - 1;
+        dest[i] = line[newer] + frac * (line[older] - line[newer]);
+
+        w = wrap(w + 1);
+    }
+
+    // Close enough - stop gliding.
+    if (std::abs(target - delay) < 1e-9) delay = target;
+
+    delay_[k] = delay;
+    set_offset(k);
+}
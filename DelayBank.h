@@ -0,0 +1,128 @@
+/*
+  ==============================================================================
+
+    DelayBank.h
+    Many short, independent delay lines run side by side - one per voice,
+    say - with all their samples in one slab.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// A bank of delay lines that share one buffer and one write position.
+//
+// The lines sit one after another in a single slab, each with a fixed
+// stride, so line k's history is slab_[k * stride_ + pos]. Everything else
+// about a line - its delay, where it is gliding to, the whole and fractional
+// parts of its read offset - is in arrays indexed by line. There are no
+// per-line objects and no per-line allocations.
+//
+// process() runs a block one line at a time. Within a line the writes and
+// the reads are each at most two contiguous runs, so the copies and the
+// interpolation loop vectorise along time. Interleaving the lines by sample
+// (so that a tick is one contiguous store across lines) was tried first. It
+// turns every read into a gather, one cache line per line per sample, and
+// was 3-5x slower on blocks, with no gain on single ticks.
+//
+// Delays are in samples and may be fractional. They are read with linear
+// interpolation. set_delay() jumps straight to a delay. change_delay() glides
+// to it, the way StereoDelayElement does, so the pitch bends rather than
+// clicks. The slab always holds max_delay samples of history, so a delay
+// change never has anything to copy or resample.
+//
+// Against one DelayLine per voice (FlexDelayBenchmarks bank, 256 sample
+// blocks, ns per line per sample):
+//
+//     lines  delays      block: bank  DelayLine    tick: bank  DelayLine
+//        64  16-256            0.51       0.68           3.9        3.5
+//       128  16-256            0.51       0.66           3.8        3.4
+//       256  16-256            0.87       0.78           3.9        4.0
+//        64  50-2000           0.55       0.51           4.0        3.6
+//       128  50-2000           0.81       0.55           4.7        3.6
+//       256  50-2000           1.34       0.82           5.7        4.2
+//
+// So it pays for short delays run in blocks, up to a hundred or so lines.
+// Past that, and for longer delays, the shared stride costs more than the
+// per-line overhead it saves: every line's slab is as long as the longest
+// delay plus a block, and the write and the read are at different places
+// in it, where a DelayLine reads and then overwrites the same samples. A
+// tick touches two cache lines per line for the same reason. Splitting
+// tick() into a store pass and a branch-free read pass across lines, so
+// the reads could be gathers, made it slower - the cost is the memory, not
+// the arithmetic.
+//
+// The plugin doesn't use this. It is built with the benchmarks only, for
+// hosts that embed the DSP code.
+//
+// Unlike DelayLine this never grows. prepare() fixes the line count, the
+// longest delay and the block size, and nothing after that allocates.
+class DelayBank {
+public:
+    DelayBank() = default;
+
+    // Room for line_count lines of up to max_delay samples each, run in
+    // blocks of up to max_block. Clears the history and sets every delay to
+    // zero. Not for the audio thread.
+    void prepare(size_t line_count, size_t max_delay, size_t max_block);
+
+    size_t get_line_count() const { return line_count_; }
+    size_t get_max_delay() const { return max_delay_; }
+
+    // Read from samples behind the input straight away.
+    void set_delay(size_t line, double samples);
+
+    // Head for samples at up to the glide rate.
+    void change_delay(size_t line, double samples);
+
+    double get_delay(size_t line) const { return delay_[line]; }
+
+    // How fast change_delay moves, in samples of delay per sample.
+    void set_glide_rate(double samples_per_sample) { glide_rate_ = samples_per_sample; }
+
+    // Zero the history of every line, or of just the one.
+    void clear();
+    void clear(size_t line);
+
+    // One block for every line. in[k] and out[k] are line k's samples, and
+    // may be the same buffer. num_samples must not exceed max_block.
+    void process(const double* const* in, double* const* out, size_t num_samples);
+
+    // One sample for every line. in and out hold line_count values each and
+    // may be the same array.
+    void tick(const double* in, double* out);
+
+private:
+    // Matches StereoDelayElement's DELTA_FACTOR.
+    static constexpr double DEFAULT_GLIDE_RATE = 0.3;
+
+    size_t line_count_ = 0;
+    size_t max_delay_ = 0;
+    size_t max_block_ = 0;
+
+    // Samples per line in the slab. Enough that a whole block can be
+    // written before any of it is read, and that the older of the two
+    // samples we interpolate between is still there.
+    size_t stride_ = 0;
+    size_t write_pos_ = 0;
+
+    std::vector<double> slab_;
+
+    // Per line.
+    std::vector<double> delay_;
+    std::vector<double> target_;
+    std::vector<size_t> whole_;
+    std::vector<double> fraction_;
+
+    double glide_rate_ = DEFAULT_GLIDE_RATE;
+
+    void write(double* line, const double* src, size_t num_samples);
+    void read(const double* line, size_t start, double frac, double* dest, size_t num_samples);
+    void read_gliding(size_t k, const double* line, double* dest, size_t num_samples);
+
+    void set_offset(size_t k);
+    size_t wrap(size_t pos) const { return pos >= stride_ ? pos - stride_ : pos; }
+};
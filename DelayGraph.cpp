@@ -0,0 +1,384 @@
+/*
+  ==============================================================================
+
+    DelayGraph.cpp
+    A small network of delays, taps, gains and filters, compiled into a
+    flat per-block schedule.
+
+  ==============================================================================
+*/
+
+#include "DelayGraph.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+namespace {
+    constexpr double PI = 3.14159265358979323846;
+}
+
+DelayGraph::DelayGraph() {
+    clear();
+}
+
+void DelayGraph::clear() {
+    specs_.clear();
+    edges_.clear();
+    dirty_ = true;
+    add_node(NodeType::INPUT, 0.0);
+    add_node(NodeType::OUTPUT, 0.0);
+}
+
+DelayGraph::NodeId DelayGraph::add_node(NodeType type, double param, NodeId source) {
+    specs_.push_back({ type, param, source });
+    dirty_ = true;
+    return NodeId(specs_.size() - 1);
+}
+
+DelayGraph::NodeId DelayGraph::add_delay(double msec) {
+    return add_node(NodeType::DELAY, msec);
+}
+
+DelayGraph::NodeId DelayGraph::add_tap(NodeId delay_node, double msec) {
+    return add_node(NodeType::TAP, msec, delay_node);
+}
+
+DelayGraph::NodeId DelayGraph::add_gain(double db) {
+    return add_node(NodeType::GAIN, db);
+}
+
+DelayGraph::NodeId DelayGraph::add_filter(double cutoff_hz) {
+    return add_node(NodeType::FILTER, cutoff_hz);
+}
+
+void DelayGraph::connect(NodeId from, NodeId to) {
+    edges_.push_back({ from, to });
+    dirty_ = true;
+}
+
+bool DelayGraph::compile(double sample_rate, int max_block, int channels) {
+
+    if (!dirty_ && sample_rate == compiled_rate_ && max_block == compiled_block_ && channels == channels_) {
+        return compiled_ok_;
+    }
+
+    dirty_ = false;
+    compiled_ok_ = false;
+    compiled_rate_ = sample_rate;
+    compiled_block_ = max_block;
+
+    active_ = false;
+    schedule_.clear();
+    pool_.clear();
+    lines_.clear();
+    filter_state_.clear();
+    channels_ = channels;
+
+    if (edges_.empty()) {
+        compiled_ok_ = true;
+        return true;
+    }
+
+    // NodeIds are ints for the caller. Check them once here and index with
+    // size_t from then on.
+    auto node_count = specs_.size();
+    auto valid = [&](NodeId n) { return n >= 0 && size_t(n) < node_count; };
+
+    std::vector<std::vector<size_t>> preds(node_count);
+    std::vector<std::vector<size_t>> succs(node_count);
+
+    for (auto& e : edges_) {
+        if (!valid(e.from) || !valid(e.to)) return false;
+        if (e.to == input() || e.from == output()) return false;
+
+        auto from = size_t(e.from);
+        auto to = size_t(e.to);
+        if (specs_[to].type == NodeType::TAP) return false;
+        preds[to].push_back(from);
+        succs[from].push_back(to);
+    }
+
+    // A tap has to run after the delay it reads from.
+    for (size_t n = 0; n < node_count; ++n) {
+        if (specs_[n].type != NodeType::TAP) continue;
+        if (!valid(specs_[n].source)) return false;
+        auto src = size_t(specs_[n].source);
+        if (specs_[src].type != NodeType::DELAY) return false;
+        preds[n].push_back(src);
+        succs[src].push_back(n);
+    }
+
+    // Only keep what leads to the output.
+    auto output_node = size_t(output());
+    std::vector<bool> keep(node_count, false);
+    std::deque<size_t> work { output_node };
+    keep[output_node] = true;
+    while (!work.empty()) {
+        auto n = work.front();
+        work.pop_front();
+        for (auto p : preds[n]) {
+            if (!keep[p]) {
+                keep[p] = true;
+                work.push_back(p);
+            }
+        }
+    }
+
+    // Kahn's algorithm. Everything kept leads to the output, so the output
+    // always comes out last.
+    std::vector<int> pending(node_count, 0);
+    for (size_t n = 0; n < node_count; ++n) {
+        if (!keep[n]) continue;
+        for (auto p : preds[n]) {
+            if (keep[p]) ++pending[n];
+        }
+    }
+
+    std::vector<size_t> order;
+    for (size_t n = 0; n < node_count; ++n) {
+        if (keep[n] && pending[n] == 0) work.push_back(n);
+    }
+    while (!work.empty()) {
+        auto n = work.front();
+        work.pop_front();
+        order.push_back(n);
+        for (auto s : succs[n]) {
+            if (keep[s] && --pending[s] == 0) work.push_back(s);
+        }
+    }
+
+    auto kept_count = size_t(std::count(keep.begin(), keep.end(), true));
+    if (order.size() != kept_count) {
+        // A cycle. Feedback needs a different design - a delay can't see
+        // its own output within the block.
+        return false;
+    }
+
+    // Where in the order each node's output is read for the last time.
+    std::vector<int> position(node_count, -1);
+    for (size_t i = 0; i < order.size(); ++i) position[order[i]] = int(i);
+
+    std::vector<int> last_use(node_count, -1);
+    for (auto n : order) {
+        for (auto s : succs[n]) {
+            if (keep[s]) last_use[n] = std::max(last_use[n], position[s]);
+        }
+    }
+
+    // Hand out buffers in schedule order. A node may reuse the buffer of
+    // its first input if nobody reads that input after it - except a delay,
+    // which can't run in place and reads its input straight from where it
+    // is. Other inputs
+    // that die here go back in the free list afterwards, so they can't be
+    // overwritten while we are still summing them.
+    std::vector<int> buffer_of(node_count, EXTERNAL);
+    std::vector<int> free_buffers;
+    int buffer_count = 0;
+
+    auto longest_tap = std::vector<size_t>(node_count, 0);
+    for (auto n : order) {
+        if (specs_[n].type == NodeType::TAP) {
+            auto age = size_t(std::max(0.0, specs_[n].param) * 0.001 * sample_rate);
+            auto& longest = longest_tap[size_t(specs_[n].source)];
+            longest = std::max(longest, age);
+        }
+    }
+
+    std::vector<int> line_of(node_count, -1);
+    int filter_count = 0;
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        auto n = order[i];
+        auto pos = int(i);
+        const auto& spec = specs_[n];
+
+        // The graph input is the caller's buffer; nothing to run.
+        if (spec.type == NodeType::INPUT) continue;
+
+        Step step;
+        step.type = spec.type;
+        step.factor = 1.0;
+        step.tap_age = 0;
+        step.line_index = -1;
+        step.state_index = -1;
+
+        if (spec.type != NodeType::TAP) {
+            for (auto p : preds[n]) {
+                if (keep[p]) step.inputs.push_back(buffer_of[p]);
+            }
+        }
+
+        if (spec.type == NodeType::OUTPUT) {
+            step.out_buffer = EXTERNAL;
+        }
+        else {
+            int out = -1;
+            if (spec.type != NodeType::DELAY && !step.inputs.empty() && step.inputs[0] != EXTERNAL
+                    && last_use[preds[n][0]] == pos) {
+                out = step.inputs[0];
+            }
+            else if (!free_buffers.empty()) {
+                out = free_buffers.back();
+                free_buffers.pop_back();
+            }
+            else {
+                out = buffer_count++;
+            }
+            step.out_buffer = out;
+            buffer_of[n] = out;
+        }
+
+        for (auto p : preds[n]) {
+            if (!keep[p] || last_use[p] != pos) continue;
+            auto b = buffer_of[p];
+            if (b == EXTERNAL || b == step.out_buffer) continue;
+            // The same edge may have been added twice.
+            if (std::find(free_buffers.begin(), free_buffers.end(), b) == free_buffers.end()) {
+                free_buffers.push_back(b);
+            }
+        }
+
+        switch (spec.type) {
+        case NodeType::INPUT:
+        case NodeType::OUTPUT:
+            // Nothing beyond summing the inputs.
+            break;
+        case NodeType::DELAY: {
+            auto samples = size_t(std::max(1.0, spec.param * 0.001 * sample_rate));
+            std::vector<std::unique_ptr<DelayLine>> per_channel;
+            for (int c = 0; c < channels; ++c) {
+                auto line = std::make_unique<DelayLine>(samples);
+                line->prepare(size_t(max_block));
+                // Room for the taps to look back a whole block further.
+                line->reserve(std::max(samples, longest_tap[n]) + size_t(max_block) + 1);
+                per_channel.push_back(std::move(line));
+            }
+            line_of[n] = int(lines_.size());
+            step.line_index = line_of[n];
+            lines_.push_back(std::move(per_channel));
+            break;
+        }
+        case NodeType::TAP:
+            step.line_index = line_of[size_t(spec.source)];
+            step.tap_age = size_t(std::max(0.0, spec.param) * 0.001 * sample_rate);
+            break;
+        case NodeType::GAIN:
+            step.factor = utils::db_to_factor(spec.param);
+            break;
+        case NodeType::FILTER:
+            step.factor = 1.0 - std::exp(-2.0 * PI * spec.param / sample_rate);
+            step.state_index = filter_count++;
+            break;
+        }
+
+        schedule_.push_back(std::move(step));
+    }
+
+    auto block = size_t(std::max(max_block, 1));
+    pool_.assign(size_t(buffer_count), std::vector<double>(block, 0.0));
+    filter_state_.assign(size_t(filter_count * channels), 0.0);
+    delay_in_.assign(block, 0.0);
+
+    active_ = true;
+    compiled_ok_ = true;
+    return true;
+}
+
+void DelayGraph::process(int channel, double* samples, int num_samples) {
+
+    if (!active_) return;
+
+    // The buffers were sized for max_block. If the host sends more than it
+    // promised, go through it in pieces that fit. The delays and taps only
+    // ever look back from the newest sample, so the result is the same.
+    auto remaining = size_t(std::max(num_samples, 0));
+    while (remaining > 0) {
+        auto n = std::min(remaining, delay_in_.size());
+        process_chunk(channel, samples, n);
+        samples += n;
+        remaining -= n;
+    }
+}
+
+void DelayGraph::process_chunk(int channel, double* samples, size_t n) {
+
+    auto buffer = [&](int index) -> double* {
+        return (index == EXTERNAL) ? samples : pool_[size_t(index)].data();
+    };
+
+    for (auto& step : schedule_) {
+        auto* out = buffer(step.out_buffer);
+
+        if (step.type == NodeType::TAP) {
+            // After the delay has run, its newest sample is input[n-1]. Sample
+            // i of the tap is tap_age before input[i].
+            const auto& line = *lines_[size_t(step.line_index)][size_t(channel)];
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = line.tap(n - 1 - i + step.tap_age);
+            }
+            continue;
+        }
+
+        if (step.type == NodeType::DELAY) {
+            // Never one of its own inputs, so a single input goes straight
+            // in. Several are summed first.
+            const double* in = delay_in_.data();
+            if (step.inputs.empty()) {
+                std::fill(delay_in_.data(), delay_in_.data() + n, 0.0);
+            }
+            else if (step.inputs.size() == 1) {
+                in = buffer(step.inputs[0]);
+            }
+            else {
+                for (size_t i = 0; i < n; ++i) {
+                    double sum = 0.0;
+                    for (auto index : step.inputs) sum += buffer(index)[i];
+                    delay_in_[i] = sum;
+                }
+            }
+
+            lines_[size_t(step.line_index)][size_t(channel)]->process_block(in, out, n);
+            continue;
+        }
+
+        // Sum the inputs. This goes sample by sample across the inputs, so
+        // it is safe for out to be one of them.
+        if (step.inputs.empty()) {
+            std::fill(out, out + n, 0.0);
+        }
+        else if (step.inputs.size() == 1) {
+            auto* in = buffer(step.inputs[0]);
+            if (in != out) std::copy(in, in + n, out);
+        }
+        else {
+            for (size_t i = 0; i < n; ++i) {
+                double sum = 0.0;
+                for (auto index : step.inputs) sum += buffer(index)[i];
+                out[i] = sum;
+            }
+        }
+
+        switch (step.type) {
+        case NodeType::GAIN:
+            for (size_t i = 0; i < n; ++i) out[i] *= step.factor;
+            break;
+        case NodeType::FILTER: {
+            auto& y = filter_state_[size_t(step.state_index * channels_ + channel)];
+            for (size_t i = 0; i < n; ++i) {
+                y += step.factor * (out[i] - y);
+                out[i] = y;
+            }
+            break;
+        }
+        case NodeType::INPUT:
+        case NodeType::OUTPUT:
+        case NodeType::DELAY:
+        case NodeType::TAP:
+            // INPUT is never scheduled, OUTPUT only sums, and DELAY and TAP
+            // were handled above.
+            break;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+/*
+  ==============================================================================
+
+    DelayGraph.h
+    A small network of delays, taps, gains and filters, compiled into a
+    flat per-block schedule.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "DelayLine.h"
+
+#include <memory>
+#include <vector>
+
+// Describe the network with the add_* / connect calls, then compile() it
+// (from prepareToPlay). Editing the description never touches what the
+// audio thread is running; changes take effect at the next compile().
+//
+// A node with several inputs sums them, and a node's output can feed any
+// number of nodes, so serial and parallel chains are just edges. Nodes that
+// don't lead to output() are dropped at compile time.
+//
+// compile() sorts the nodes so every node runs after its inputs and then
+// works out when each node's output is last read. Intermediate buffers are
+// shared between nodes whose outputs are never live at the same time, so a
+// deep chain only needs a couple of them. process() then runs the whole
+// block through one node at a time.
+class DelayGraph {
+public:
+    enum class NodeType {
+        INPUT,
+        OUTPUT,
+        DELAY,      // param = msec
+        TAP,        // param = msec, read from the history of another DELAY
+        GAIN,       // param = dB
+        FILTER,     // param = cutoff Hz, one pole low pass
+    };
+
+    using NodeId = int;
+
+    struct NodeSpec {
+        NodeType type;
+        double param;
+        NodeId source;      // TAP only
+    };
+
+    struct Edge {
+        NodeId from;
+        NodeId to;
+    };
+
+    DelayGraph();
+
+    NodeId input() const { return 0; }
+    NodeId output() const { return 1; }
+
+    NodeId add_delay(double msec);
+    // A second read point on delay_node's input, msec behind it. The tap
+    // is fed from the delay's history, so it needs no input of its own.
+    NodeId add_tap(NodeId delay_node, double msec);
+    NodeId add_gain(double db);
+    NodeId add_filter(double cutoff_hz);
+
+    void connect(NodeId from, NodeId to);
+
+    // Back to just input() and output().
+    void clear();
+
+    // Not for the audio thread. Returns false (and leaves the graph
+    // inactive) if the description has a cycle or a bad connection. If
+    // nothing has changed since the last compile this keeps the running
+    // graph as it is, delay contents and all.
+    bool compile(double sample_rate, int max_block, int channels);
+
+    // True if the last compile produced something to run. With no edges
+    // at all the graph is inactive and process() should be skipped.
+    bool is_active() const { return active_; }
+
+    // In place, on one channel. A block longer than compile()'s max_block
+    // is run max_block samples at a time.
+    void process(int channel, double* samples, int num_samples);
+
+    // For looking at the result of compile().
+    int get_schedule_length() const { return int(schedule_.size()); }
+    int get_buffer_count() const { return int(pool_.size()); }
+
+    // The description as it stands, in NodeId order, for SessionRecorder.
+    const std::vector<NodeSpec>& get_nodes() const { return specs_; }
+    const std::vector<Edge>& get_edges() const { return edges_; }
+
+private:
+    // The description.
+    std::vector<NodeSpec> specs_;
+    std::vector<Edge> edges_;
+
+    // What compile() built.
+    static constexpr int EXTERNAL = -1;     // read/write the caller's samples
+
+    struct Step {
+        NodeType type;
+        int out_buffer;             // pool index, or EXTERNAL
+        std::vector<int> inputs;    // pool indexes, or EXTERNAL for the graph input
+        double factor;              // GAIN: linear gain, FILTER: coefficient
+        size_t tap_age;             // TAP: samples behind the delay's input
+        int line_index;             // DELAY/TAP: which entry in lines_
+        int state_index;            // FILTER: which entry in filter_state_
+    };
+
+    std::vector<Step> schedule_;
+    std::vector<std::vector<double>> pool_;
+
+    // lines_[line_index][channel]
+    std::vector<std::vector<std::unique_ptr<DelayLine>>> lines_;
+    // filter_state_[state_index * channels_ + channel]
+    std::vector<double> filter_state_;
+
+    // Where a delay with several inputs sums them. compile() never gives a
+    // delay an input's buffer for its output, so it needs nothing else.
+    std::vector<double> delay_in_;
+
+    int channels_ = 0;
+    bool active_ = false;
+
+    // What the last compile was for. dirty_ is set by any edit.
+    bool dirty_ = true;
+    bool compiled_ok_ = false;
+    double compiled_rate_ = 0.0;
+    int compiled_block_ = 0;
+
+    NodeId add_node(NodeType type, double param, NodeId source = -1);
+
+    // One piece of process(), no longer than the buffers.
+    void process_chunk(int channel, double* samples, size_t n);
+};
@@ -17,7 +17,7 @@
 
 void DelayLine::clear() {
     if (!buffer_) {
-        buffer_ = std::make_unique<double[]>(buffer_length_);
+        buffer_ = std::make_unique<double[]>(capacity_);
     }
     else {
         std::fill(buffer_.get(), buffer_.get() + buffer_length_, 0.0);
@@ -33,12 +33,115 @@ void DelayLine::set_delay(size_t new_size) {
     //DBG("DelayLine::set_delay - force setting delay to " << new_size << " samples");
 
     buffer_length_ = new_size;
-    buffer_.reset(nullptr);
+
+    // Only reallocate if we have to. We're not on the audio thread, so it is
+    // safe to do it here.
+    if (new_size > capacity_) {
+        capacity_ = new_size;
+        buffer_.reset(nullptr);
+    }
 
     // clear will take care of the details.
     clear();
 }
 
+void DelayLine::prepare(size_t max_block) {
+    // StereoDelayElement never moves the delay by more than a fraction of a
+    // block at a time, so twice the block is plenty for the change path.
+    temp_buffer_.reserve(2 * max_block);
+    fade_buffer_.reserve(max_block);
+}
+
+void DelayLine::reserve(size_t new_capacity) {
+    if (new_capacity <= capacity_) return;
+
+    // Copy the whole history, oldest first, so that tap() still sees it
+    // in order. The newest sample lands at old_capacity - 1. Only the new
+    // space past it needs zeroing.
+    auto old_capacity = capacity_;
+    std::unique_ptr<double[]> new_buffer(new double[new_capacity]);
+
+    auto oldest = (last_insert_pos_ + 1) % old_capacity;
+    std::copy(buffer_.get() + oldest, buffer_.get() + old_capacity, new_buffer.get());
+    std::copy(buffer_.get(), buffer_.get() + oldest, new_buffer.get() + (old_capacity - oldest));
+    std::fill(new_buffer.get() + old_capacity, new_buffer.get() + new_capacity, 0.0);
+
+    std::swap(buffer_, new_buffer);
+    capacity_ = new_capacity;
+    last_insert_pos_ = old_capacity - 1;
+    next_return_pos_ = old_capacity - size_t(valid_sample_count_);
+}
+
+void DelayLine::resample_to(size_t new_size) {
+
+    auto old_size = size_t(valid_sample_count_);
+    if (new_size == old_size && old_size == buffer_length_) return;
+
+    // The kernels want the samples in one piece, oldest first, at the
+    // front of the storage.
+    if (next_return_pos_ + old_size > capacity_) {
+        std::rotate(buffer_.get(), buffer_.get() + next_return_pos_, buffer_.get() + capacity_);
+    }
+    else if (next_return_pos_ > 0) {
+        std::copy(buffer_.get() + next_return_pos_, buffer_.get() + next_return_pos_ + old_size, buffer_.get());
+    }
+    next_return_pos_ = 0;
+
+    if (new_size <= capacity_) {
+        // The usual case - StereoDelayElement reserves for the new rate
+        // before it gets here.
+        resample_in_place(quality_, buffer_.get(), old_size, new_size);
+    }
+    else {
+        // Every sample of the new buffer is written by the resample, so
+        // there's no point zeroing it first.
+        std::unique_ptr<double[]> new_buffer(new double[new_size]);
+        resample(quality_, buffer_.get(), old_size, new_buffer.get(), new_size);
+
+        std::swap(buffer_, new_buffer);
+        capacity_ = new_size;
+    }
+
+    buffer_length_ = new_size;
+    reset();
+}
+
+bool DelayLine::can_grow_to(size_t new_size) {
+    if (new_size <= capacity_ || exchange_.ready(new_size)) return true;
+
+    exchange_.request(size_t(new_size * GROWTH_FACTOR));
+    return false;
+}
+
+bool DelayLine::ensure_capacity(size_t new_size) {
+
+    if (new_size <= capacity_) return true;
+
+    size_t new_capacity = 0;
+    auto fresh = exchange_.take(new_size, new_capacity);
+    if (fresh == nullptr) {
+        exchange_.request(size_t(new_size * GROWTH_FACTOR));
+        return false;
+    }
+
+    // Move what we have to the start of the new buffer, oldest first, as
+    // copy_state_from does.
+    auto count = size_t(valid_sample_count_);
+    auto first = std::min(count, capacity_ - next_return_pos_);
+    std::copy(buffer_.get() + next_return_pos_, buffer_.get() + next_return_pos_ + first, fresh.get());
+    std::copy(buffer_.get(), buffer_.get() + (count - first), fresh.get() + first);
+
+    std::swap(buffer_, fresh);
+    capacity_ = new_capacity;
+    next_return_pos_ = 0;
+    last_insert_pos_ = (count + capacity_ - 1) % capacity_;
+
+    // fresh now holds the old storage.
+    exchange_.retire(std::move(fresh));
+
+    return true;
+}
+
 /*
 void DelayLine::resize(size_t new_size, DelayLine::ResizeAlgo algo) {
 
@@ -141,155 +244,160 @@ void DelayLine::resize(size_t new_size, DelayLine::ResizeAlgo algo) {
 
 */
 
-void DelayLine::do_delay(const std::vector<double>& input, std::vector<double>& output, int target_delay) {
+bool DelayLine::copy_state_from(const DelayLine& other) {
 
-    output.clear();
+    auto count = size_t(other.valid_sample_count_);
+    if (count > capacity_) return false;
 
-    if (target_delay < 0 || target_delay == buffer_length_) {
-        // The delay isn't changing, so we just need to copy from
-        // the buffer to the output.
-        for (int i = 0; i < input.size(); ++i) {
-            output.push_back(get_next());
-            add(input[i]);
-        }
-        return;
-    }
+    // Oldest first, into the start of our buffer.
+    auto first = std::min(count, other.capacity_ - other.next_return_pos_);
+    std::copy(other.buffer_.get() + other.next_return_pos_, other.buffer_.get() + other.next_return_pos_ + first, buffer_.get());
+    std::copy(other.buffer_.get(), other.buffer_.get() + (count - first), buffer_.get() + first);
 
-    // We assume that the target delay is "reasonably" close to our
-    // current delay.
-    // The idea is that we take just enough samples out of the delay line so that
-    // when we add back in the input, the delay line winds up being the new
-    // length. The samples are then up(or down) sampled to fit the size that
-    // we are expected to return.
+    valid_sample_count_ = int(count);
+    next_return_pos_ = 0;
+    last_insert_pos_ = (count + capacity_ - 1) % capacity_;
+    buffer_length_ = other.buffer_length_;
+    quality_ = other.quality_;
+    next_quality_ = other.next_quality_;
 
-    // delta should be positive if we are making the delay smaller.
-    // This is because we need to take more samples off the buffer.
-    int delta = buffer_length_ - target_delay;
+    return true;
+}
 
-    assert(std::abs(delta) < input.size()-2);
+void DelayLine::read_block(double* dest, size_t count) {
 
-    int temp_buffer_size = input.size() + delta;
+    auto available = std::min(count, size_t(valid_sample_count_));
 
-    std::vector<double> temp_buffer;
+    auto first = std::min(available, capacity_ - next_return_pos_);
+    std::copy(buffer_.get() + next_return_pos_, buffer_.get() + next_return_pos_ + first, dest);
+    std::copy(buffer_.get(), buffer_.get() + (available - first), dest + first);
 
-    int inp_index = 0;
-    for (int i = 0; i < temp_buffer_size; ++i) {
-        temp_buffer.push_back(get_next());
-        // Add the input in case the current delay is so short that
-        // we need part of the input to feed the output.
-        if (inp_index < input.size())
-            add(input[inp_index++]);
-    }
+    next_return_pos_ = (next_return_pos_ + available) % capacity_;
+    valid_sample_count_ -= int(available);
 
-    // Create the new buffer and fill it with anything left in the delay line 
-    // as well as anything more from the input (in that order).
-    auto new_buffer = std::make_unique<double[]>(target_delay);
-    int write_pos = 0;
-    while (valid_sample_count_ > 0) {
-        new_buffer[write_pos] = get_next();
-        ++write_pos;
-    }
+    std::fill(dest + available, dest + count, 0.0);
+}
 
-    for (; inp_index < input.size(); ++inp_index) {
-        new_buffer[write_pos] = input[inp_index];
-        ++write_pos;
+void DelayLine::write_block(const double* src, size_t count) {
+
+    // More than we can hold - only the newest capacity_ samples survive,
+    // just as if add() had been called that many times.
+    if (count > capacity_) {
+        valid_sample_count_ += int(count - capacity_);
+        last_insert_pos_ = (last_insert_pos_ + (count - capacity_)) % capacity_;
+        src += count - capacity_;
+        count = capacity_;
     }
-    assert(valid_sample_count_ <= target_delay);
 
-    // patch up all our invariants
-    std::swap(buffer_, new_buffer);
-    buffer_length_ = target_delay;
-    reset();
+    auto start = (last_insert_pos_ + 1) % capacity_;
+    auto first = std::min(count, capacity_ - start);
+    std::copy(src, src + first, buffer_.get() + start);
+    std::copy(src + first, src + count, buffer_.get());
 
-    // Resampling :
-    // Use a much simplified interpolation/decimation algorithm.
-    // If the delay line is going from I samples long to J samples long,
-    // act as if we had done the following:
-    // Step 1 : interpolate J-2 samples between each sample. This gives us
-    //      (I-1)*(J-1)+1 samples because we can't interpolate past the last sample.
-    // Step 2: take every (I-1)th sample. This leaves us with J samples.
-    //
-    // Rather than create that massive intermediate series of samples, we'll
-    // note the following:
-    //
-    // The nth sample in the new series is the n*(I-1) sample in the
-    // augmented series.
-    // That means it is on or after the div(J-1,n*(I-1)) sample in the old series.
-    // It is in the mod(J-1, n*(I-1)) interpolation slot.
-    // We can do this one linear interpolation (or whatever algo we choose) to
-    // get this value.
-    //
-    // This algorithm always takes the first and last samples.
-
-    // If were going to do this for realzies we would need to add a low
-    // pass filter to get rid of aliasing effects, etc.
+    last_insert_pos_ = (last_insert_pos_ + count) % capacity_;
+    valid_sample_count_ += int(count);
+}
 
-    // For this I (current length) = length of the temp buffer we filled.
-    //          J (new length)     = length of the input.
+void DelayLine::process_block(const double* input, double* output, size_t count) {
+
+    while (count > 0) {
+        if (valid_sample_count_ == 0) {
+            // get_next() on an empty line gives silence and the sample goes
+            // straight in.
+            *output++ = 0.0;
+            add(*input++);
+            --count;
+            continue;
+        }
+
+        // Everything we read in this chunk was in the line before any of
+        // the chunk was written, which is what the per-sample loop does.
+        auto chunk = std::min(count, size_t(valid_sample_count_));
+        read_block(output, chunk);
+        write_block(input, chunk);
+
+        input += chunk;
+        output += chunk;
+        count -= chunk;
+    }
+}
+
+bool DelayLine::do_delay(const std::vector<double>& input, std::vector<double>& output, int target_delay) {
+    output.resize(input.size());
+    return do_delay(input.data(), output.data(), input.size(), target_delay);
+}
+
+bool DelayLine::do_delay(const double* input, double* output, size_t count, int target_delay) {
 
-    // Cubic interpolation : https://www.paulinternet.nlk/?page=bicubic with
-    //  hints from http://paulbourke.net/miscellaneous/interpolation
+    // If we are growing past our storage, go as far as we can this time and
+    // let the caller try again next block.
+    if (target_delay > 0 && !ensure_capacity(size_t(target_delay))) {
+        target_delay = int(capacity_);
+    }
 
-    auto old_size = temp_buffer.size();
-    auto new_size = input.size();
+    if (target_delay < 0 || size_t(target_delay) == buffer_length_) {
+        // The delay isn't changing, so we just need to copy from
+        // the buffer to the output.
+        // Nothing is being interpolated, so a new kernel can take over right away.
+        quality_ = next_quality_;
+        process_block(input, output, count);
+        return false;
+    }
 
-    // Values from the original series used in the interpolation. We will be interpolating 
-    // in the interval between base_values[1] and base_values[2]
-    double base_values[4];
+    // We assume that the target delay is "reasonably" close to our
+    // current delay.
+    // The idea is that we take just enough samples out of the delay line so that
+    // when we add back in the input, the delay line winds up being the new
+    // length. The samples are then up(or down) sampled to fit the size that
+    // we are expected to return.
 
-    // Convenience variable - the J-1 value from the discussion above.
-    auto new_step = new_size - 1;
+    // delta should be positive if we are making the delay smaller.
+    // This is because we need to take more samples off the buffer.
+    int delta = int(buffer_length_) - target_delay;
 
-    for (size_t n = 0; n < new_size; ++n) {
-        // n = index in the "new" series
-   
-        // i = index in the augmented series
-        auto i = n * (old_size - 1);
+    assert(std::abs(delta) < count-2);
 
-        // f = index in the original series
-        auto f = i / new_step;
+    int temp_buffer_size = int(count) + delta;
 
-        // s = "slot" along the line from f to f+1
-        auto s = i % new_step;
+    temp_buffer_.resize(size_t(temp_buffer_size));
 
+    // Read and write side by side in case the current delay is so short
+    // that we need part of the input to feed the output.
+    auto both = std::min(size_t(temp_buffer_size), count);
+    process_block(input, temp_buffer_.data(), both);
 
-        double interpolation;
+    // Then either take the extra samples off (shrinking) or put the rest of
+    // the input in behind what is still in the line (growing). The line
+    // never holds more than the larger of the old and new delays, which
+    // ensure_capacity has made room for.
+    read_block(temp_buffer_.data() + both, size_t(temp_buffer_size) - both);
+    write_block(input + both, count - both);
 
-        if ((s == 0) || (f >= (old_size-1))) {
-            interpolation = temp_buffer[f];
-        }
-        else {
-            if (f == 0) {
-                // we will make this nicer later
-                base_values[0] = temp_buffer[f];
-            }
-            else {
-                base_values[0] = temp_buffer[f - 1];
-            }
+    assert(valid_sample_count_ == target_delay);
 
-            base_values[1] = temp_buffer[f];
-            base_values[2] = temp_buffer[f + 1];
+    buffer_length_ = size_t(target_delay);
 
-            if (f == old_size - 2) {
-                // we will make this nicer later
-                base_values[3] = temp_buffer[f+1];
-            }
-            else {
-                base_values[3] = temp_buffer[f + 2];
-            }
+    // Now stretch (or squash) what we pulled out to the size we are expected
+    // to return. See Interpolation.h for the algorithm and the kernels.
+    // For this I (current length) = length of the temp buffer we filled.
+    //          J (new length)     = length of the input.
 
-            double a, b, c, d;
-            a = -0.5 * base_values[0] + 1.5 * base_values[1] - 1.5 * base_values[2] + 0.5 * base_values[3];
-            b =        base_values[0] - 2.5 * base_values[1] + 2   * base_values[2] - 0.5 * base_values[3];
-            c = -0.5 * base_values[0]                        + 0.5 * base_values[2];
-            d =                               base_values[1];
+    resample(quality_, temp_buffer_.data(), temp_buffer_.size(), output, count);
 
-            auto mu = double(s) / double(new_size);
+    if (next_quality_ != quality_) {
+        // Switching kernels mid-change. Run both and crossfade so that the
+        // (small) difference between them doesn't click.
+        fade_buffer_.resize(count);
+        resample(next_quality_, temp_buffer_.data(), temp_buffer_.size(), fade_buffer_.data(), fade_buffer_.size());
 
-            interpolation = a * mu*mu*mu + b*mu*mu + c*mu + d;
+        auto step = 1.0 / double(count);
+        for (size_t n = 0; n < count; ++n) {
+            auto gain = double(n + 1) * step;
+            output[n] += gain * (fade_buffer_[n] - output[n]);
         }
 
-        output.push_back(interpolation);
+        quality_ = next_quality_;
     }
-    
+
+    return true;
 }
@@ -9,29 +9,63 @@
 */
 
 #pragma once
+#include "BufferExchange.h"
+#include "Interpolation.h"
+
 #include <memory>
+#include <utility>
 #include <vector>
 
+// A FIFO of samples. The delay is how many samples are in it.
+//
+// The storage (capacity) can be bigger than the delay so that the delay
+// can change without reallocating. If a change needs more room than we
+// have, do_delay asks the background allocator (see BufferExchange.h) for
+// a bigger buffer and holds the delay at capacity until it turns up.
 class DelayLine {
 public:
 
-    DelayLine(size_t buffer_length = 100) : buffer_length_(buffer_length)
+    DelayLine(size_t buffer_length = 100) : capacity_(buffer_length > 0 ? buffer_length : 1), buffer_length_(buffer_length)
     {
         clear();
     }
 
     size_t get_delay() const { return buffer_length_; }
+    size_t get_capacity() const { return capacity_; }
 
     // Changes the delay to the new size samples.
     // Does a hard reset on the delay line - clearing all data.
+    // May allocate, so not for the audio thread.
     void set_delay(size_t new_size);
 
+    // Size the scratch space for blocks of up to max_block samples.
+    // Not for the audio thread.
+    void prepare(size_t max_block);
+
+    // Make sure the storage holds at least new_capacity samples, keeping
+    // the delay and its contents. Not for the audio thread.
+    void reserve(size_t new_capacity);
+
+    // Stretch (or squash) what is in the line to new_size samples, in one
+    // pass with the current interpolation kernel. Used when the sample rate
+    // changes, so the same stretch of time stays in the line. Works in place
+    // if new_size fits in the capacity, and allocates if not, so not for
+    // the audio thread.
+    void resample_to(size_t new_size);
+
+    // The sample that was add()ed `age` samples before the most recent one.
+    // This reads the storage directly, so it can see further back than the
+    // delay, up to (but not including) the capacity.
+    double tap(size_t age) const {
+        return buffer_[(last_insert_pos_ + capacity_ - age) % capacity_];
+    }
+
     // Add a sample to the end of the buffer.
     // Currently fails to fail if the buffer is full.
     void add(double sample) {
         valid_sample_count_ += 1;
 
-        if (last_insert_pos_ >= (buffer_length_-1)) {
+        if (last_insert_pos_ >= (capacity_-1)) {
             last_insert_pos_ = 0;
         }
         else {
@@ -50,25 +84,86 @@ public:
         auto ret_val = buffer_[next_return_pos_];
         --valid_sample_count_;
         ++next_return_pos_;
-        if (next_return_pos_ >= buffer_length_) next_return_pos_ = 0;
+        if (next_return_pos_ >= capacity_) next_return_pos_ = 0;
 
         return ret_val;
     }
 
-    void do_delay(const std::vector<double>& input, std::vector<double>&output, int target_delay=-1);
+    // Block versions of get_next() and add(). Each is at most two straight
+    // copies, one either side of the wrap.
+    // read_block zero fills anything past the end of what is in the line.
+    void read_block(double* dest, size_t count);
+    void write_block(const double* src, size_t count);
+
+    // The same as calling get_next() then add() for each sample, for a delay
+    // that isn't changing. input and output must not overlap. On a line far
+    // bigger than the cache this runs at about memcpy speed - see
+    // `FlexDelayBenchmarks bandwidth`.
+    void process_block(const double* input, double* output, size_t count);
+
+    // Returns true if the delay changed, so the block went through the
+    // interpolation kernel.
+    bool do_delay(const std::vector<double>& input, std::vector<double>&output, int target_delay=-1);
+    // The same, on count samples. input and output must not overlap.
+    bool do_delay(const double* input, double* output, size_t count, int target_delay=-1);
+
+    // Which kernel do_delay uses to stretch/squash a block when the delay changes.
+    // If a change is in progress, the switch is crossfaded over the next block.
+    void set_interpolation(InterpolationQuality q) { next_quality_ = q; }
+    InterpolationQuality get_interpolation() const { return next_quality_; }
+
+    // Make this line an exact copy of other - same delay, same samples, same
+    // interpolation state. Doesn't allocate; returns false if other holds
+    // more than we have room for.
+    bool copy_state_from(const DelayLine& other);
+
+    // Both the kernel in use and the one we are heading for, so that two
+    // lines can be compared.
+    std::pair<InterpolationQuality, InterpolationQuality> get_interpolation_state() const {
+        return { quality_, next_quality_ };
+    }
+
+    // For the background allocator.
+    BufferExchange& get_exchange() { return exchange_; }
+
+    // Audio thread. True if the line has room for new_size samples, or a
+    // buffer that big is waiting for ensure_capacity() to pick up. If not,
+    // asks the allocator for one.
+    bool can_grow_to(size_t new_size);
+
+    // Make sure there is room for new_size samples. Returns false (and asks
+    // for a bigger buffer) if there isn't yet. Audio thread safe.
+    bool ensure_capacity(size_t new_size);
 
 private:
+    // Ask for this much more than we need when growing, so that a delay
+    // that is sweeping upwards doesn't have to wait on every block.
+    static constexpr double GROWTH_FACTOR = 1.5;
+
     std::unique_ptr<double[]> buffer_;
+    size_t capacity_;
     size_t last_insert_pos_;
     size_t next_return_pos_ = 0;
     int valid_sample_count_ = 0;
     size_t buffer_length_;
+    InterpolationQuality quality_ = InterpolationQuality::CUBIC;
+    InterpolationQuality next_quality_ = InterpolationQuality::CUBIC;
+
+    // Preallocated by prepare() so that do_delay doesn't have to.
+    std::vector<double> temp_buffer_;
+    std::vector<double> fade_buffer_;
 
+    BufferExchange exchange_;
+
+    // The contents are [0, buffer_length_) and are all valid.
     void reset() {
-        valid_sample_count_ = buffer_length_;
-        last_insert_pos_ = buffer_length_;
+        valid_sample_count_ = int(buffer_length_);
+        last_insert_pos_ = (buffer_length_ + capacity_ - 1) % capacity_;
         next_return_pos_ = 0;
     }
 
     void clear(); 
+
+    DelayLine(const DelayLine&) = delete;
+    DelayLine& operator=(const DelayLine&) = delete;
 };
\ No newline at end of file
@@ -0,0 +1,73 @@
+/*
+  ==============================================================================
+
+    Interpolation.cpp
+    Fractional-delay interpolators used when a delay line is resized.
+
+  ==============================================================================
+*/
+
+#include "Interpolation.h"
+
+#include <cmath>
+
+namespace {
+    constexpr double PI = 3.14159265358979323846;
+
+    // Cutoff of the sinc kernel as a fraction of Nyquist. Slightly under 1
+    // so the short window can roll off before Nyquist.
+    constexpr double SINC_CUTOFF = 0.9;
+}
+
+InterpolationTables::InterpolationTables() {
+
+    for (int p = 0; p <= PHASES; ++p) {
+        double mu = double(p) / PHASES;
+
+        // Lagrange : l_k(x) = prod over j != k of (x - x_j) / (x_k - x_j)
+        for (int k = 0; k < LAGRANGE_TAPS; ++k) {
+            double xk = LAGRANGE_FIRST + k;
+            double coeff = 1.0;
+            for (int j = 0; j < LAGRANGE_TAPS; ++j) {
+                if (j == k) continue;
+                double xj = LAGRANGE_FIRST + j;
+                coeff *= (mu - xj) / (xk - xj);
+            }
+            lagrange[p][k] = coeff;
+        }
+
+        // Windowed sinc. Normalise each phase to unity gain at DC.
+        double total = 0.0;
+        for (int k = 0; k < SINC_TAPS; ++k) {
+            double x = double(SINC_FIRST + k) - mu;
+            double arg = PI * SINC_CUTOFF * x;
+            double s = (x == 0.0) ? 1.0 : std::sin(arg) / arg;
+
+            // Blackman window spanning the whole kernel.
+            double w_pos = (x - SINC_FIRST + 1) / double(SINC_TAPS);
+            double w = 0.42 - 0.5 * std::cos(2 * PI * w_pos) + 0.08 * std::cos(4 * PI * w_pos);
+
+            sinc[p][k] = s * w;
+            total += s * w;
+        }
+        for (auto& c : sinc[p]) {
+            c /= total;
+        }
+    }
+}
+
+const InterpolationTables& interpolation_tables() {
+    static const InterpolationTables tables;
+    return tables;
+}
+
+const char* interpolation_quality_name(InterpolationQuality q) {
+    switch (q) {
+    case InterpolationQuality::NONE:     return "None";
+    case InterpolationQuality::LINEAR:   return "Linear";
+    case InterpolationQuality::CUBIC:    return "Cubic";
+    case InterpolationQuality::LAGRANGE: return "Lagrange";
+    case InterpolationQuality::SINC:     return "Sinc";
+    }
+    return "";
+}
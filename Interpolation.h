@@ -0,0 +1,80 @@
+/*
+  ==============================================================================
+
+    Interpolation.h
+    Fractional-delay interpolators used when a delay line is resized.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstddef>
+
+// Interpolation tiers, cheapest first.
+//
+// From `FlexDelayBenchmarks quality` (Benchmarks.cpp). Each tier resamples a
+// sine by 1.3x - the largest step StereoDelayElement takes in one block -
+// and THD+N is everything in the output that isn't that sine (harmonics,
+// images, aliases) relative to it, at the output frequency shown. Cost is
+// per output sample in 512 sample blocks with the scalar kernels, Release
+// build (g++ 12 -O3, x86-64 Xeon). The benchmark also times the wider
+// kernels (Kernels.h); they only help CUBIC and SINC much.
+//
+//      tier        1kHz      10kHz     18kHz    ns/sample
+//      NONE        -30 dB    -10 dB     -4 dB      3.7
+//      LINEAR      -67 dB    -26 dB    -13 dB      4.0
+//      CUBIC       -96 dB    -34 dB    -16 dB      7.3
+//      LAGRANGE   -145 dB    -45 dB    -21 dB     11.6
+//      SINC        -94 dB    -81 dB    -76 dB     25.4
+//
+// (44.1kHz sample rate.) The sinc passband ripple limits it at low
+// frequencies, but it is the only tier that holds up near Nyquist. Its
+// cutoff is fixed at 0.9 Nyquist, so it does not band limit further when the
+// delay shrinks.
+enum class InterpolationQuality {
+    NONE,       // nearest earlier sample
+    LINEAR,
+    CUBIC,      // Catmull-Rom (cubic Hermite)
+    LAGRANGE,   // 4th order, 5 point
+    SINC,       // Blackman windowed sinc, 16 point polyphase
+};
+
+constexpr int INTERPOLATION_QUALITY_COUNT = int(InterpolationQuality::SINC) + 1;
+
+// Coefficient tables for the table driven kernels. Each row holds the taps
+// for one fractional position; there is one extra row so that the kernels
+// can blend between neighbouring rows without a wrap check.
+struct InterpolationTables {
+    static constexpr int PHASES = 256;
+
+    static constexpr int LAGRANGE_TAPS = 5;
+    static constexpr int LAGRANGE_FIRST = -2;     // offset of tap 0 from the base sample
+
+    static constexpr int SINC_TAPS = 16;
+    static constexpr int SINC_FIRST = -7;
+
+    // Plain arrays rather than std::array, so that the per instruction set
+    // kernels (see Kernels.h) don't instantiate any shared inline code.
+    double lagrange[PHASES + 1][LAGRANGE_TAPS];
+    double sinc[PHASES + 1][SINC_TAPS];
+
+    InterpolationTables();
+};
+
+// The tables are built on first use. Call this from prepareToPlay so that
+// it never happens on the audio thread.
+const InterpolationTables& interpolation_tables();
+
+const char* interpolation_quality_name(InterpolationQuality q);
+
+// Resample old_size samples from src into new_size samples in dst, always
+// keeping the first and last samples. The kernels themselves are in
+// KernelsImpl.h; this picks the tier once per call, so there is no switch in
+// the sample loop, and uses whichever instruction set select_kernels() chose.
+void resample(InterpolationQuality q, const double* src, size_t old_size, double* dst, size_t new_size);
+
+// The same, from and to the start of buf, which must have room for
+// max(old_size, new_size) samples. Uses no other storage, so a delay line
+// that already has the room can resample without allocating.
+void resample_in_place(InterpolationQuality q, double* buf, size_t old_size, size_t new_size);
@@ -0,0 +1,265 @@
+/*
+  ==============================================================================
+
+    Kernels.cpp
+    The hot loops, built once per instruction set and picked at load time.
+
+  ==============================================================================
+*/
+
+#include "Kernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#if FLEXDELAY_X86_KERNELS
+ #if defined(_MSC_VER)
+  #include <intrin.h>
+ #else
+  #include <cpuid.h>
+ #endif
+#endif
+
+namespace {
+    std::atomic<const KernelTable*> active_kernels { nullptr };
+
+    std::atomic<bool> verify { false };
+    std::atomic<double> max_deviation { 0.0 };
+
+    // The verifier works in pieces this big, on the stack.
+    constexpr size_t VERIFY_CHUNK = 256;
+
+    // resample_in_place works in pieces this big, on the stack. It has to
+    // be more than the furthest any kernel reaches back (SINC_FIRST) plus
+    // one for rounding.
+    constexpr size_t IN_PLACE_CHUNK = 64;
+    static_assert(IN_PLACE_CHUNK > size_t(1 - InterpolationTables::SINC_FIRST), "in place chunks are too short");
+
+    const KernelTable& active() {
+        auto* k = active_kernels.load(std::memory_order_relaxed);
+        return (k != nullptr) ? *k : kernels_scalar::table();
+    }
+
+    bool verifying(const KernelTable& k) {
+        return verify.load(std::memory_order_relaxed) && &k != &kernels_scalar::table();
+    }
+
+    template <typename T>
+    void note_deviation(const T* a, const T* b, size_t count) {
+        double worst = 0.0;
+        for (size_t i = 0; i < count; ++i) {
+            worst = std::max(worst, std::abs(double(a[i]) - double(b[i])));
+        }
+
+        auto current = max_deviation.load();
+        while (worst > current && !max_deviation.compare_exchange_weak(current, worst)) {
+        }
+    }
+}
+
+#if FLEXDELAY_X86_KERNELS
+namespace {
+    bool has_osxsave() {
+        // CPUID leaf 1, ECX bit 27: the OS has turned on XSAVE, so XGETBV works.
+#if defined(_MSC_VER)
+        int regs[4] = {};
+        __cpuid(regs, 1);
+        return (unsigned(regs[2]) & (1u << 27)) != 0;
+#else
+        unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) return false;
+        return (ecx & (1u << 27)) != 0;
+#endif
+    }
+
+    uint64_t read_xcr0() {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        // The instruction rather than _xgetbv(), which needs -mxsave.
+        uint32_t lo = 0, hi = 0;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return (uint64_t(hi) << 32) | lo;
+#endif
+    }
+}
+#endif
+
+KernelLevel os_kernel_limit() {
+#if FLEXDELAY_X86_KERNELS
+    // A CPU can have AVX while the OS doesn't save the wider registers on a
+    // context switch - an old kernel, or a VM that masks it. XCR0 says which
+    // register state the OS saves: bits 1-2 are SSE and AVX, bits 5-7 the
+    // AVX-512 mask and upper ZMM registers.
+    if (!has_osxsave()) return KernelLevel::SSE41;
+
+    auto xcr0 = read_xcr0();
+    if ((xcr0 & 0x06) != 0x06) return KernelLevel::SSE41;
+    if ((xcr0 & 0xe0) != 0xe0) return KernelLevel::AVX2;
+    return KernelLevel::AVX512;
+#else
+    return KernelLevel::SCALAR;
+#endif
+}
+
+const char* kernel_level_name(KernelLevel level) {
+    switch (level) {
+    case KernelLevel::SCALAR: return "Scalar";
+    case KernelLevel::SSE41:  return "SSE4.1";
+    case KernelLevel::AVX2:   return "AVX2";
+    case KernelLevel::AVX512: return "AVX-512";
+    }
+    return "";
+}
+
+KernelLevel select_kernels(KernelLevel supported) {
+    const KernelTable* chosen = &kernels_scalar::table();
+    supported = std::min(supported, os_kernel_limit());
+
+#if FLEXDELAY_X86_KERNELS
+    if (supported >= KernelLevel::AVX512) {
+        chosen = &kernels_avx512::table();
+    }
+    else if (supported >= KernelLevel::AVX2) {
+        chosen = &kernels_avx2::table();
+    }
+    else if (supported >= KernelLevel::SSE41) {
+        chosen = &kernels_sse41::table();
+    }
+#endif
+
+    active_kernels.store(chosen);
+    return chosen->level;
+}
+
+KernelLevel get_kernel_level() {
+    return active().level;
+}
+
+void set_kernel_verify(bool on) {
+    verify.store(on);
+}
+
+bool get_kernel_verify() {
+    return verify.load();
+}
+
+double get_kernel_max_deviation() {
+    return max_deviation.load();
+}
+
+void reset_kernel_max_deviation() {
+    max_deviation.store(0.0);
+}
+
+void resample(InterpolationQuality q, const double* src, size_t old_size, double* dst, size_t new_size) {
+    const auto& tables = interpolation_tables();
+    const auto& k = active();
+
+    k.resample[int(q)](tables, src, old_size, dst, new_size, 0, new_size);
+
+    if (!verifying(k)) return;
+
+    const auto reference = kernels_scalar::table().resample[int(q)];
+    double expected[VERIFY_CHUNK];
+    for (size_t begin = 0; begin < new_size; begin += VERIFY_CHUNK) {
+        auto end = std::min(new_size, begin + VERIFY_CHUNK);
+        reference(tables, src, old_size, expected, new_size, begin, end);
+        note_deviation(dst + begin, expected, end - begin);
+    }
+}
+
+void resample_in_place(InterpolationQuality q, double* buf, size_t old_size, size_t new_size) {
+    const auto& tables = interpolation_tables();
+    const auto& k = active();
+    const auto kernel = k.resample[int(q)];
+    const auto reference = kernels_scalar::table().resample[int(q)];
+
+    // Output sample n reads the source from about n * (old_size - 1) /
+    // (new_size - 1) onwards, less the few samples a kernel reaches back.
+    // When shrinking that is never behind n. When growing it falls behind,
+    // by at most new_size - old_size - so move the source up to the end of
+    // the space first, and then it isn't.
+    const double* src = buf;
+    if (new_size > old_size) {
+        std::copy_backward(buf, buf + old_size, buf + new_size);
+        src = buf + (new_size - old_size);
+    }
+
+    // So the output can overwrite the source, as long as it stays more
+    // than a kernel's reach behind what is still to be read. Each piece is
+    // worked out before the one before it is written back.
+    double pieces[2][IN_PLACE_CHUNK];
+    double expected[IN_PLACE_CHUNK];
+    size_t piece = 0;
+
+    for (size_t begin = 0; begin < new_size; begin += IN_PLACE_CHUNK, piece ^= 1) {
+        auto end = std::min(new_size, begin + IN_PLACE_CHUNK);
+        kernel(tables, src, old_size, pieces[piece], new_size, begin, end);
+
+        if (verifying(k)) {
+            reference(tables, src, old_size, expected, new_size, begin, end);
+            note_deviation(pieces[piece], expected, end - begin);
+        }
+
+        if (begin > 0) {
+            const auto* previous = pieces[piece ^ 1];
+            std::copy(previous, previous + IN_PLACE_CHUNK, buf + begin - IN_PLACE_CHUNK);
+        }
+    }
+
+    if (new_size > 0) {
+        auto last = (new_size - 1) / IN_PLACE_CHUNK * IN_PLACE_CHUNK;
+        const auto* previous = pieces[piece ^ 1];
+        std::copy(previous, previous + (new_size - last), buf + last);
+    }
+}
+
+void mix_block(const double* wet, float* io, size_t num_samples, double wet_level, double dry_level, double scale) {
+    const auto& k = active();
+
+    if (!verifying(k)) {
+        k.mix(wet, io, num_samples, wet_level, dry_level, scale);
+        return;
+    }
+
+    // io is overwritten, so keep a copy of each piece for the reference.
+    const auto reference = kernels_scalar::table().mix;
+    float expected[VERIFY_CHUNK];
+    for (size_t begin = 0; begin < num_samples; begin += VERIFY_CHUNK) {
+        auto count = std::min(num_samples - begin, VERIFY_CHUNK);
+        std::copy(io + begin, io + begin + count, expected);
+
+        k.mix(wet + begin, io + begin, count, wet_level, dry_level, scale);
+        reference(wet + begin, expected, count, wet_level, dry_level, scale);
+        note_deviation(io + begin, expected, count);
+    }
+}
+
+void mix_block_stereo(const double* wet_left, const double* wet_right, float* io_left, float* io_right,
+        size_t num_samples, double wet_level, double dry_level, double scale) {
+    const auto& k = active();
+
+    if (!verifying(k)) {
+        k.mix_stereo(wet_left, wet_right, io_left, io_right, num_samples, wet_level, dry_level, scale);
+        return;
+    }
+
+    const auto reference = kernels_scalar::table().mix_stereo;
+    float expected_left[VERIFY_CHUNK];
+    float expected_right[VERIFY_CHUNK];
+    for (size_t begin = 0; begin < num_samples; begin += VERIFY_CHUNK) {
+        auto count = std::min(num_samples - begin, VERIFY_CHUNK);
+        std::copy(io_left + begin, io_left + begin + count, expected_left);
+        std::copy(io_right + begin, io_right + begin + count, expected_right);
+
+        k.mix_stereo(wet_left + begin, wet_right + begin, io_left + begin, io_right + begin,
+            count, wet_level, dry_level, scale);
+        reference(wet_left + begin, wet_right + begin, expected_left, expected_right,
+            count, wet_level, dry_level, scale);
+        note_deviation(io_left + begin, expected_left, count);
+        note_deviation(io_right + begin, expected_right, count);
+    }
+}
@@ -0,0 +1,85 @@
+/*
+  ==============================================================================
+
+    Kernels.h
+    The hot loops, built once per instruction set and picked at load time.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "Interpolation.h"
+
+#include <cstddef>
+
+// Instruction sets we build kernels for, oldest first. On anything that
+// isn't x86 only SCALAR is built.
+enum class KernelLevel {
+    SCALAR,     // whatever the compiler targets by default (SSE2 on x86-64)
+    SSE41,
+    AVX2,       // with FMA
+    AVX512,     // F, DQ and VL
+};
+
+constexpr int KERNEL_LEVEL_COUNT = int(KernelLevel::AVX512) + 1;
+
+const char* kernel_level_name(KernelLevel level);
+
+// One set of kernels. Every entry is compiled from the same source
+// (KernelsImpl.h) in its own translation unit, with that unit's compiler
+// flags.
+struct KernelTable {
+    KernelLevel level;
+
+    // Samples [begin, end) of a resample of old_size samples to new_size,
+    // written to dst[0, end - begin). The range lets the verifier check a
+    // call in pieces.
+    using ResampleKernel = void (*)(const InterpolationTables& tables, const double* src, size_t old_size,
+        double* dst, size_t new_size, size_t begin, size_t end);
+    ResampleKernel resample[INTERPOLATION_QUALITY_COUNT];
+
+    // io[i] = (wet_level * wet[i] + dry_level * io[i]) * scale
+    using MixKernel = void (*)(const double* wet, float* io, size_t num_samples,
+        double wet_level, double dry_level, double scale);
+    MixKernel mix;
+
+    // mix for a left and a right channel together.
+    using MixStereoKernel = void (*)(const double* wet_left, const double* wet_right, float* io_left, float* io_right,
+        size_t num_samples, double wet_level, double dry_level, double scale);
+    MixStereoKernel mix_stereo;
+};
+
+namespace kernels_scalar { const KernelTable& table(); }
+#if FLEXDELAY_X86_KERNELS
+namespace kernels_sse41 { const KernelTable& table(); }
+namespace kernels_avx2 { const KernelTable& table(); }
+namespace kernels_avx512 { const KernelTable& table(); }
+#endif
+
+// Use the best kernels that were built and that the CPU supports. The
+// caller works out which instructions the CPU has (the processor asks
+// juce::SystemStats), which keeps this code free of JUCE. That is capped
+// at os_kernel_limit(), since having the instructions is no use if the OS
+// doesn't save the registers they use. Call once at load, before any audio
+// runs (the replayer also calls it between blocks, from the one thread it
+// has). Returns the level actually chosen.
+KernelLevel select_kernels(KernelLevel supported);
+KernelLevel get_kernel_level();
+
+// The highest level whose registers the OS saves (OSXSAVE and XCR0 on x86).
+// SCALAR anywhere else.
+KernelLevel os_kernel_limit();
+
+// Verify mode runs the scalar kernels alongside the chosen ones and keeps
+// the largest difference seen. It doesn't allocate, but it roughly doubles
+// the cost of every kernel, so it is for debugging.
+void set_kernel_verify(bool on);
+bool get_kernel_verify();
+double get_kernel_max_deviation();
+void reset_kernel_max_deviation();
+
+// See KernelTable::mix and KernelTable::mix_stereo.
+void mix_block(const double* wet, float* io, size_t num_samples, double wet_level, double dry_level, double scale);
+void mix_block_stereo(const double* wet_left, const double* wet_right, float* io_left, float* io_right,
+    size_t num_samples, double wet_level, double dry_level, double scale);
@@ -0,0 +1,13 @@
+/*
+  ==============================================================================
+
+    KernelsAVX2.cpp
+    The kernels built for AVX2 and FMA. CMakeLists.txt sets the flags.
+
+  ==============================================================================
+*/
+
+#define FLEXDELAY_KERNEL_NAMESPACE kernels_avx2
+#define FLEXDELAY_KERNEL_LEVEL KernelLevel::AVX2
+
+#include "KernelsImpl.h"
@@ -0,0 +1,13 @@
+/*
+  ==============================================================================
+
+    KernelsAVX512.cpp
+    The kernels built for AVX-512 (F, DQ, VL). CMakeLists.txt sets the flags.
+
+  ==============================================================================
+*/
+
+#define FLEXDELAY_KERNEL_NAMESPACE kernels_avx512
+#define FLEXDELAY_KERNEL_LEVEL KernelLevel::AVX512
+
+#include "KernelsImpl.h"
@@ -0,0 +1,204 @@
+/*
+  ==============================================================================
+
+    KernelsImpl.h
+    The source of the hot loops. Each Kernels*.cpp includes this once, in
+    its own namespace, and is compiled for its own instruction set.
+
+  ==============================================================================
+*/
+
+// No #pragma once on purpose - see Kernels*.cpp.
+//
+// Everything here is in an anonymous namespace inside the per instruction set
+// namespace, so none of it is shared between translation units. If it were,
+// the linker could keep the AVX-512 copy of an inline function and hand it
+// to the scalar code. For the same reason nothing here calls into the
+// standard library - std::min and friends are inline functions too, and an
+// unoptimised build won't inline them.
+
+#include "Kernels.h"
+
+#if !defined(FLEXDELAY_KERNEL_NAMESPACE) || !defined(FLEXDELAY_KERNEL_LEVEL)
+#error "Define FLEXDELAY_KERNEL_NAMESPACE and FLEXDELAY_KERNEL_LEVEL before including KernelsImpl.h"
+#endif
+
+namespace FLEXDELAY_KERNEL_NAMESPACE {
+namespace {
+
+// One kernel per tier. at() returns the value between src[f] and src[f+1],
+// mu in [0, 1). Taps that fall outside [0, size) are clamped to the ends.
+template <InterpolationQuality Q>
+struct Interpolator;
+
+template <>
+struct Interpolator<InterpolationQuality::NONE> {
+    static double at(const InterpolationTables&, const double* src, size_t, size_t f, double) {
+        return src[f];
+    }
+};
+
+template <>
+struct Interpolator<InterpolationQuality::LINEAR> {
+    static double at(const InterpolationTables&, const double* src, size_t size, size_t f, double mu) {
+        auto next = (f + 1 < size) ? src[f + 1] : src[f];
+        return src[f] + mu * (next - src[f]);
+    }
+};
+
+template <>
+struct Interpolator<InterpolationQuality::CUBIC> {
+    static double at(const InterpolationTables&, const double* src, size_t size, size_t f, double mu) {
+        // Cubic interpolation : https://www.paulinternet.nl/?page=bicubic with
+        //  hints from http://paulbourke.net/miscellaneous/interpolation
+        double p0 = (f == 0) ? src[f] : src[f - 1];
+        double p1 = src[f];
+        double p2 = (f + 1 < size) ? src[f + 1] : src[f];
+        double p3 = (f + 2 < size) ? src[f + 2] : p2;
+
+        double a = -0.5 * p0 + 1.5 * p1 - 1.5 * p2 + 0.5 * p3;
+        double b =        p0 - 2.5 * p1 + 2   * p2 - 0.5 * p3;
+        double c = -0.5 * p0              + 0.5 * p2;
+        double d =                   p1;
+
+        return ((a * mu + b) * mu + c) * mu + d;
+    }
+};
+
+// Blend two adjacent table rows and apply them around src[f].
+template <size_t TAPS>
+double apply_table(const double (&table)[InterpolationTables::PHASES + 1][TAPS],
+        int first, const double* src, size_t size, size_t f, double mu) {
+
+    auto pos = mu * InterpolationTables::PHASES;
+    auto row = size_t(pos);
+    auto frac = pos - double(row);
+
+    const double* lo = table[row];
+    const double* hi = table[row + 1];
+
+    // Fast path - all taps are inside the source.
+    auto start = ptrdiff_t(f) + first;
+    if (start >= 0 && size_t(start) + TAPS <= size) {
+        const double* s = src + start;
+        double sum = 0.0;
+        for (size_t k = 0; k < TAPS; ++k) {
+            sum += (lo[k] + frac * (hi[k] - lo[k])) * s[k];
+        }
+        return sum;
+    }
+
+    double sum = 0.0;
+    for (size_t k = 0; k < TAPS; ++k) {
+        auto idx = start + ptrdiff_t(k);
+        if (idx < 0) idx = 0;
+        if (idx >= ptrdiff_t(size)) idx = ptrdiff_t(size) - 1;
+        sum += (lo[k] + frac * (hi[k] - lo[k])) * src[idx];
+    }
+    return sum;
+}
+
+template <>
+struct Interpolator<InterpolationQuality::LAGRANGE> {
+    static double at(const InterpolationTables& t, const double* src, size_t size, size_t f, double mu) {
+        return apply_table(t.lagrange, InterpolationTables::LAGRANGE_FIRST, src, size, f, mu);
+    }
+};
+
+template <>
+struct Interpolator<InterpolationQuality::SINC> {
+    static double at(const InterpolationTables& t, const double* src, size_t size, size_t f, double mu) {
+        return apply_table(t.sinc, InterpolationTables::SINC_FIRST, src, size, f, mu);
+    }
+};
+
+// Resample old_size samples from src into new_size samples in dst.
+//
+// Use a much simplified interpolation/decimation algorithm.
+// If the series is going from I samples long to J samples long,
+// act as if we had done the following:
+// Step 1 : interpolate J-2 samples between each sample. This gives us
+//      (I-1)*(J-1)+1 samples because we can't interpolate past the last sample.
+// Step 2: take every (I-1)th sample. This leaves us with J samples.
+//
+// Rather than create that massive intermediate series of samples, we'll
+// note the following:
+//
+// The nth sample in the new series is the n*(I-1) sample in the
+// augmented series.
+// That means it is on or after the div(J-1,n*(I-1)) sample in the old series.
+// It is in the mod(J-1, n*(I-1)) interpolation slot.
+//
+// This algorithm always takes the first and last samples.
+//
+// Only samples [begin, end) are produced, starting at dst[0].
+template <InterpolationQuality Q>
+void resample(const InterpolationTables& tables, const double* src, size_t old_size,
+        double* dst, size_t new_size, size_t begin, size_t end) {
+
+    if (new_size == 0) return;
+
+    if (new_size == 1 || old_size < 2) {
+        for (size_t n = begin; n < end; ++n) {
+            dst[n - begin] = (old_size > 0) ? src[0] : 0.0;
+        }
+        return;
+    }
+
+    // Convenience variable - the J-1 value from the discussion above.
+    auto new_step = new_size - 1;
+    auto inv_step = 1.0 / double(new_step);
+
+    for (size_t n = begin; n < end; ++n) {
+        // i = index in the augmented series
+        auto i = n * (old_size - 1);
+
+        // f = index in the original series
+        auto f = i / new_step;
+
+        // s = "slot" along the line from f to f+1
+        auto s = i % new_step;
+
+        if ((s == 0) || (f >= (old_size - 1))) {
+            dst[n - begin] = src[f];
+        }
+        else {
+            dst[n - begin] = Interpolator<Q>::at(tables, src, old_size, f, double(s) * inv_step);
+        }
+    }
+}
+
+void mix(const double* wet, float* io, size_t num_samples, double wet_level, double dry_level, double scale) {
+    for (size_t i = 0; i < num_samples; ++i) {
+        io[i] = float((wet_level * wet[i] + dry_level * io[i]) * scale);
+    }
+}
+
+// Both channels in one pass, so a stereo block is one loop and one call.
+void mix_stereo(const double* wet_left, const double* wet_right, float* io_left, float* io_right,
+        size_t num_samples, double wet_level, double dry_level, double scale) {
+    for (size_t i = 0; i < num_samples; ++i) {
+        io_left[i] = float((wet_level * wet_left[i] + dry_level * io_left[i]) * scale);
+        io_right[i] = float((wet_level * wet_right[i] + dry_level * io_right[i]) * scale);
+    }
+}
+
+} // namespace
+
+const KernelTable& table() {
+    static const KernelTable kernels = {
+        FLEXDELAY_KERNEL_LEVEL,
+        {
+            resample<InterpolationQuality::NONE>,
+            resample<InterpolationQuality::LINEAR>,
+            resample<InterpolationQuality::CUBIC>,
+            resample<InterpolationQuality::LAGRANGE>,
+            resample<InterpolationQuality::SINC>,
+        },
+        mix,
+        mix_stereo,
+    };
+    return kernels;
+}
+
+} // namespace FLEXDELAY_KERNEL_NAMESPACE
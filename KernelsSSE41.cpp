@@ -0,0 +1,13 @@
+/*
+  ==============================================================================
+
+    KernelsSSE41.cpp
+    The kernels built for SSE4.1. CMakeLists.txt sets the flags.
+
+  ==============================================================================
+*/
+
+#define FLEXDELAY_KERNEL_NAMESPACE kernels_sse41
+#define FLEXDELAY_KERNEL_LEVEL KernelLevel::SSE41
+
+#include "KernelsImpl.h"
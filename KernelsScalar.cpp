@@ -0,0 +1,13 @@
+/*
+  ==============================================================================
+
+    KernelsScalar.cpp
+    The kernels built for the compiler's default target. CMakeLists.txt sets the flags.
+
+  ==============================================================================
+*/
+
+#define FLEXDELAY_KERNEL_NAMESPACE kernels_scalar
+#define FLEXDELAY_KERNEL_LEVEL KernelLevel::SCALAR
+
+#include "KernelsImpl.h"
@@ -39,7 +39,7 @@ FlexDelayAudioProcessorEditor::FlexDelayAudioProcessorEditor (FlexDelayAudioProc
     addAndMakeVisible(wet_mix_label);
 
     // === delay ==========================================
-    delay_msec_slider.setRange(1, 2000, 0.1);
+    delay_msec_slider.setRange(1, StereoDelayElement::MAX_DELAY_MSEC, 0.1);
     delay_msec_slider.setTextValueSuffix(" msec");
     delay_msec_slider.setValue(200);
     delay_msec_slider.setDoubleClickReturnValue(true, 200.0, juce::ModifierKeys::ctrlModifier);
@@ -50,6 +50,21 @@ FlexDelayAudioProcessorEditor::FlexDelayAudioProcessorEditor (FlexDelayAudioProc
     delay_msec_label.attachToComponent(&delay_msec_slider, true);
     addAndMakeVisible(delay_msec_label);
 
+    // === interpolation ==========================================
+    // Combo item ids must be non-zero, so they are the enum value + 1.
+    for (int q = 0; q < INTERPOLATION_QUALITY_COUNT; ++q) {
+        interpolation_box.addItem(interpolation_quality_name(InterpolationQuality(q)), q + 1);
+    }
+    interpolation_box.setSelectedId(int(audioProcessor.interpolation_quality) + 1, juce::dontSendNotification);
+    interpolation_box.onChange = [this] {
+        audioProcessor.interpolation_quality = InterpolationQuality(interpolation_box.getSelectedId() - 1);
+    };
+    addAndMakeVisible(interpolation_box);
+
+    interpolation_label.setText("Interpolation", juce::dontSendNotification);
+    interpolation_label.attachToComponent(&interpolation_box, true);
+    addAndMakeVisible(interpolation_label);
+
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
     setSize (400, 300);
@@ -81,4 +96,5 @@ void FlexDelayAudioProcessorEditor::resized()
     main_output_level_slider.setBounds(sliderLeft, slider_height * 1, getWidth() - sliderLeft - 10, slider_height);
     wet_mix_slider.setBounds(sliderLeft, slider_height * 2, getWidth() - sliderLeft - 10, slider_height);
     delay_msec_slider.setBounds(sliderLeft, slider_height * 3, getWidth() - sliderLeft - 10, slider_height);
+    interpolation_box.setBounds(sliderLeft, slider_height * 4, getWidth() - sliderLeft - 10, slider_height);
 }
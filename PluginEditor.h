@@ -39,5 +39,8 @@ private:
     juce::Slider delay_msec_slider;
     juce::Label  delay_msec_label;
 
+    juce::ComboBox interpolation_box;
+    juce::Label    interpolation_label;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FlexDelayAudioProcessorEditor)
 };
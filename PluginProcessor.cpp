@@ -8,8 +8,38 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "Kernels.h"
 #include "utils.h"
 
+#include <cstring>
+
+namespace {
+
+	// The best kernels this CPU has the instructions for. select_kernels()
+	// also checks that the OS saves the registers they need. FLEXDELAY_KERNELS
+	// can name a lower level (e.g. "sse4.1") to compare against.
+	KernelLevel supported_kernel_level() {
+		auto level = KernelLevel::SCALAR;
+		if (juce::SystemStats::hasSSE41()) {
+			level = KernelLevel::SSE41;
+		}
+		if (juce::SystemStats::hasAVX2() && juce::SystemStats::hasFMA3()) {
+			level = KernelLevel::AVX2;
+		}
+		if (juce::SystemStats::hasAVX512F() && juce::SystemStats::hasAVX512DQ() && juce::SystemStats::hasAVX512VL()) {
+			level = KernelLevel::AVX512;
+		}
+
+		auto forced = juce::SystemStats::getEnvironmentVariable("FLEXDELAY_KERNELS", {});
+		for (int i = 0; i < KERNEL_LEVEL_COUNT; ++i) {
+			if (forced.equalsIgnoreCase(kernel_level_name(KernelLevel(i)))) {
+				level = juce::jmin(level, KernelLevel(i));
+			}
+		}
+		return level;
+	}
+}
+
 //==============================================================================
 FlexDelayAudioProcessor::FlexDelayAudioProcessor()
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -23,9 +53,37 @@ FlexDelayAudioProcessor::FlexDelayAudioProcessor()
 	)
 #endif
 {
+	// Every instance picks the same answer, so it doesn't matter that this
+	// is global. FLEXDELAY_VERIFY_KERNELS=1 checks each kernel call against
+	// the scalar build - see Kernels.h.
+	auto level = select_kernels(supported_kernel_level());
+	DBG("using " << kernel_level_name(level) << " kernels\n");
+	if (juce::SystemStats::getEnvironmentVariable("FLEXDELAY_VERIFY_KERNELS", "0") != "0") {
+		set_kernel_verify(true);
+	}
+
+	// Debug capture for reproducing glitches - see SessionRecorder.h.
+	auto capture_path = juce::SystemStats::getEnvironmentVariable("FLEXDELAY_CAPTURE", {});
+	if (capture_path.isNotEmpty()) {
+		auto with_audio = juce::SystemStats::getEnvironmentVariable("FLEXDELAY_CAPTURE_AUDIO", "0") != "0";
+		start_capture(juce::File(capture_path), with_audio);
+	}
 }
 
 FlexDelayAudioProcessor::~FlexDelayAudioProcessor() {
+	stop_capture();
+}
+
+bool FlexDelayAudioProcessor::start_capture(const juce::File& file, bool include_audio) {
+	// If we are already running, the recorder notes the current rate,
+	// block size and layout itself. The replay will only be approximate in
+	// that case.
+	return recorder.start(file, include_audio, getSampleRate(), getBlockSize(),
+		getTotalNumInputChannels(), getTotalNumOutputChannels(), &network);
+}
+
+void FlexDelayAudioProcessor::stop_capture() {
+	recorder.stop();
 }
 
 //==============================================================================
@@ -90,14 +148,32 @@ void FlexDelayAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlo
 	// Use this method as the place to do any pre-playback
 	// initialisation that you need..
 
-	current_main_output_level = target_main_output_level;
+	auto local_delay = target_delay_msec;
+	auto local_target_level = target_main_output_level;
+	recorder.record_params(local_delay, target_wet_mix, local_target_level);
+	recorder.record_network(network);
+	recorder.record_prepare(sampleRate, samplesPerBlock, getTotalNumInputChannels(), getTotalNumOutputChannels());
+
+	current_main_output_level = local_target_level;
 
 	calculate_scale_factor();
 
-	current_delay_msec = target_delay_msec;
+	current_delay_msec = local_delay;
+
+	// Build the interpolation tables now rather than on the audio thread.
+	interpolation_tables();
+
+	// Hosts call this again on every transport or device change. Keep what
+	// is in the delay lines; a new delay time is glided to like any other.
+	DBG("delay target " << current_delay_msec << " msec in prepare\n");
+	delay_element.change_delay(current_delay_msec);
+	delay_element.prepare(sampleRate, samplesPerBlock);
+
+	if (!network.compile(sampleRate, samplesPerBlock, getTotalNumInputChannels())) {
+		DBG("delay network has a cycle or a bad connection - ignoring it\n");
+	}
 
-	DBG("setting delay to " << current_delay_msec << " msec in prepare\n");
-	delay_element.set_delay(current_delay_msec, sampleRate);
+	size_scratch(juce::jmax(getTotalNumInputChannels(), getTotalNumOutputChannels()), samplesPerBlock);
 }
 
 
@@ -105,6 +181,9 @@ void FlexDelayAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlo
 void FlexDelayAudioProcessor::releaseResources() {
 	// When playback stops, you can use this as an opportunity to free up any
 	// spare memory, etc.
+	if (get_kernel_verify()) {
+		DBG(kernel_level_name(get_kernel_level()) << " kernels, max deviation from scalar " << get_kernel_max_deviation() << "\n");
+	}
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -132,76 +211,168 @@ bool FlexDelayAudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts)
 }
 #endif
 
-void FlexDelayAudioProcessor::delay(int channel, const std::vector<double> &input, std::vector<double>& output)  {
+bool FlexDelayAudioProcessor::delay(int channel, const double* input, double* output, int num_samples)  {
+
+	auto resampled = delay_element.do_delay(channel, input, output, size_t(num_samples));
+
+	if (network.is_active()) {
+		network.process(channel, output, num_samples);
+	}
+	return resampled;
+}
 
-	// Yea, I know. But this will get more complicated once there are multiple chains of delays.
-	delay_element.do_delay(channel, input, output);
+void FlexDelayAudioProcessor::size_scratch(int channels, int max_block) {
+	input_buffer_.assign(size_t(max_block), 0.0);
+	wet_stride_ = size_t(max_block);
+	wet_.assign(size_t(channels) * wet_stride_, 0.0);
+}
+
+template <int Channels, bool Ramping>
+void FlexDelayAudioProcessor::mix(float* const* io, int processed_channels, int num_samples,
+		double wet_level, double dry_level, double target_level) {
+
+	// With Channels fixed, the loops over channels have a constant trip count
+	// and the compiler unrolls them. Channels == 0 is the general case.
+	const int channels = (Channels > 0) ? Channels : processed_channels;
+	const auto n = size_t(num_samples);
+
+	if (!Ramping) {
+		if (Channels == 2) {
+			// Both channels in one pass of the stereo kernel.
+			mix_block_stereo(wet(0), wet(1), io[0], io[1], n, wet_level, dry_level, scale_factor);
+			return;
+		}
+		for (int channel = 0; channel < channels; ++channel) {
+			// Add the wet and dry together then scale.
+			mix_block(wet(channel), io[channel], n, wet_level, dry_level, scale_factor);
+		}
+		return;
+	}
+
+	auto first_extra = getTotalNumInputChannels();
+	auto last_extra = getTotalNumOutputChannels();
+
+	auto level_delta = (target_level - current_main_output_level) / num_samples;
+	for (size_t i = 0; i < n; ++i) {
+		current_main_output_level += level_delta;
+		calculate_scale_factor();
+		for (int channel = 0; channel < channels; ++channel) {
+			// Add the wet and dry together then scale.
+			io[channel][i] = std::tanh(wet_level * wet(channel)[i] + dry_level * io[channel][i]) * scale_factor;
+		}
+		// Overkill for now, but in the future, we might have channel 0 input data be delayed into output channel 5 (e.g.)
+		// I would hope that the user would do that kind of thing by routing in the DAW, but we might as well
+		// do something kind a right.
+		for (int channel = first_extra; channel < last_extra; ++channel) {
+			io[channel][i] = std::tanh(wet_level * wet(channel)[i]) * scale_factor;
+		}
+	}
 }
 
 //==============================================================================
 void FlexDelayAudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages) {
 	juce::ScopedNoDenormals noDenormals;
+	auto start_ticks = juce::Time::getHighResolutionTicks();
+
 	auto totalNumInputChannels = getTotalNumInputChannels();
 	auto totalNumOutputChannels = getTotalNumOutputChannels();
 	auto num_samples = buffer.getNumSamples();
 
-	auto input_buffer = std::vector<double>();
-
-	std::vector<std::vector<double>> wets;
-	wets.resize(totalNumOutputChannels);
+	// These were sized in prepareToPlay, so none of this allocates unless
+	// the host breaks its promise about the block size.
+	auto scratch_channels = juce::jmax(totalNumInputChannels, totalNumOutputChannels);
+	if (size_t(num_samples) > wet_stride_ || wet_.size() < size_t(scratch_channels) * wet_stride_) {
+		size_scratch(scratch_channels, num_samples);
+	}
 
 	// If the user has moved the slider, let the processor know.
+	// Take one copy of the parameters for the whole block, so that what
+	// the recorder sees is what we used.
 	auto local_delay = target_delay_msec;
+	auto local_wet_mix = target_wet_mix;
+	auto local_target_level = target_main_output_level;
+	recorder.record_params(local_delay, local_wet_mix, local_target_level);
+
 	if (local_delay != current_delay_msec) {
 		current_delay_msec = local_delay;
 		DBG("setting delay TARGET to " << current_delay_msec << " msec in process\n");
 		delay_element.change_delay(current_delay_msec);
 	}
 
-
-	for (int channel = 0; channel < totalNumInputChannels; ++channel) {
-		auto* channel_data = buffer.getWritePointer(channel);
-		input_buffer.clear();
-		input_buffer.insert(input_buffer.end(), channel_data, channel_data + num_samples);
-		delay(channel, input_buffer, wets[channel]);
+	// Offline renders always get the best tier. Otherwise let the governor
+	// pick, no higher than what the user asked for.
+	governor.set_ceiling(interpolation_quality);
+	auto block_quality = governor.get_quality();
+	if (isNonRealtime()) {
+		block_quality = InterpolationQuality::SINC;
+	}
+	else if (governor_threshold <= 0.0) {
+		block_quality = interpolation_quality;
+	}
+	delay_element.set_interpolation(block_quality);
+
+	recorder.record_block_start(buffer, block_quality, isNonRealtime());
+
+	// Dual mono material - if both inputs are the same, and so is everything
+	// we remember about them, only process the left and copy it across.
+	// The network keeps its own per-channel state, so it turns this off.
+	auto linked = false;
+	if (totalNumInputChannels == 2) {
+		auto identical = !network.is_active()
+			&& std::memcmp(buffer.getReadPointer(0), buffer.getReadPointer(1), sizeof(float) * size_t(num_samples)) == 0;
+		linked = delay_element.link_channels(identical, size_t(num_samples));
+	}
+	auto processed_channels = linked ? 1 : totalNumInputChannels;
+
+	auto resampled = false;
+	for (int channel = 0; channel < processed_channels; ++channel) {
+		auto* channel_data = buffer.getReadPointer(channel);
+		std::copy(channel_data, channel_data + num_samples, input_buffer_.data());
+		if (delay(channel, input_buffer_.data(), wet(channel), num_samples)) {
+			resampled = true;
+		}
 	}
 
 	for (int channel = totalNumInputChannels; channel < totalNumOutputChannels; ++channel) {
-		wets[channel].resize(num_samples, 0.0);
+		std::fill(wet(channel), wet(channel) + num_samples, 0.0);
 	}
 
-	auto local_target_level = target_main_output_level;
-	auto wet_level = target_wet_mix / 100.0;
+	auto wet_level = local_wet_mix / 100.0;
 	auto dry_level = 1 - wet_level;
 
-	if (local_target_level != current_main_output_level) {
-		auto level_delta = (local_target_level - current_main_output_level)/ num_samples;
-		for (size_t i = 0; i < num_samples; ++i) {
-			current_main_output_level += level_delta;
-			calculate_scale_factor();
-			for (int channel = 0; channel < totalNumInputChannels; ++channel) {
-				auto* channel_data = buffer.getWritePointer(channel);
+	// Pick the mix once for the whole block. Mono and stereo (and stereo
+	// linked down to one channel) get their own copies.
+	auto* const* io = buffer.getArrayOfWritePointers();
+	auto ramping = local_target_level != current_main_output_level;
+	if (ramping) {
+		switch (processed_channels) {
+		case 1:  mix<1, true>(io, processed_channels, num_samples, wet_level, dry_level, local_target_level); break;
+		case 2:  mix<2, true>(io, processed_channels, num_samples, wet_level, dry_level, local_target_level); break;
+		default: mix<0, true>(io, processed_channels, num_samples, wet_level, dry_level, local_target_level); break;
+		}
+	}
+	else {
+		switch (processed_channels) {
+		case 1:  mix<1, false>(io, processed_channels, num_samples, wet_level, dry_level, local_target_level); break;
+		case 2:  mix<2, false>(io, processed_channels, num_samples, wet_level, dry_level, local_target_level); break;
+		default: mix<0, false>(io, processed_channels, num_samples, wet_level, dry_level, local_target_level); break;
+		}
+	}
 
-				// Add the wet and dry together then scale.
-				channel_data[i] = std::tanh(wet_level * wets[channel][i] + dry_level * channel_data[i]) * scale_factor;
+	if (linked) {
+		buffer.copyFrom(1, 0, buffer, 0, 0, num_samples);
+	}
 
-			}
-			// Overkill for now, but in the future, we might have channel 0 input data be delayed into output channel 5 (e.g.)
-			// I would hope that the user would do that kind of thing by routing in the DAW, but we might as well
-			// do something kind a right.
-			for (int channel = totalNumInputChannels; channel < totalNumOutputChannels; ++channel) {
-				auto* channel_data = buffer.getWritePointer(channel);
-				channel_data[i] = std::tanh(wet_level * wets[channel][i]) * scale_factor;
-			}
+	recorder.record_block_end(buffer);
 
-		}
-	} else {
-		for (int channel = 0; channel < totalNumInputChannels; ++channel) {
-			auto* channel_data = buffer.getWritePointer(channel);
-			for (size_t i = 0; i < num_samples; ++i) {
-				channel_data[i] = (wet_level * wets[channel][i] + dry_level *channel_data[i]) * scale_factor;
-			}
-		}
+	// See how we did against the time this block represents. The answer
+	// decides the interpolation tier for the next block. Only blocks that
+	// went through the interpolation kernel count - a steady delay costs
+	// the same whatever the tier, so its timing says nothing about it.
+	if (resampled && governor_threshold > 0.0 && getSampleRate() > 0.0) {
+		auto elapsed = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start_ticks);
+		governor.set_threshold(governor_threshold);
+		governor.update(elapsed, num_samples / getSampleRate(), isNonRealtime());
 	}
 }
 
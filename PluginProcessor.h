@@ -10,6 +10,9 @@
 
 #include <JuceHeader.h>
 #include "StereoDelayElement.h"
+#include "DelayGraph.h"
+#include "QualityGovernor.h"
+#include "SessionRecorder.h"
 
 //==============================================================================
 /**
@@ -58,12 +61,46 @@ public:
     double target_main_output_level = 0.0;
     double target_wet_mix = 50.0;
     double target_delay_msec = 200;
+    InterpolationQuality interpolation_quality = InterpolationQuality::CUBIC;
+
+    // When a block takes longer than this fraction of its real-time budget,
+    // drop to a cheaper interpolation tier. Zero turns the governor off.
+    double governor_threshold = 0.75;
+
+    // Extra delays/taps/gains/filters run on the wet signal after the main
+    // delay. Empty (and skipped) by default. Changes take effect at the
+    // next prepareToPlay.
+    DelayGraph& get_network() { return network; }
+
+    // How many blocks were processed once and copied because the input was
+    // dual mono, and how many had to be processed per channel.
+    int get_linked_block_count() const { return delay_element.get_linked_block_count(); }
+    int get_split_block_count() const { return delay_element.get_split_block_count(); }
+
+    //==============================================================================
+    // Debug capture of the session for FlexDelayReplayer. Setting the
+    // FLEXDELAY_CAPTURE environment variable to a file path starts one at
+    // construction (add FLEXDELAY_CAPTURE_AUDIO=1 to include the audio).
+    bool start_capture(const juce::File& file, bool include_audio);
+    void stop_capture();
 
 private:
     //==============================================================================
     double current_main_output_level = 0.0;
     double scale_factor = 1.0;
     StereoDelayElement delay_element;
+    DelayGraph network;
+    QualityGovernor governor;
+    SessionRecorder recorder;
+
+    // Per-block scratch, sized in prepareToPlay. wet_ holds wet_stride_
+    // samples for each channel, one after another.
+    std::vector<double> input_buffer_;
+    std::vector<double> wet_;
+    size_t wet_stride_ = 0;
+
+    double* wet(int channel) { return wet_.data() + size_t(channel) * wet_stride_; }
+    void size_scratch(int channels, int max_block);
 
     double current_delay_msec = 200;
     int sample_rate_ = 100;
@@ -71,7 +108,15 @@ private:
 
     void calculate_scale_factor();
 
-    void delay(int channel, const std::vector<double>& input, std::vector<double>& output);
+    // Returns true if the delay line was resampled - see QualityGovernor.
+    bool delay(int channel, const double* input, double* output, int num_samples);
+
+    // The wet/dry mix and output level for one block. Channels is how many
+    // channels were processed, or 0 for any number (then processed_channels
+    // says). The ramping version also fills the outputs that have no input.
+    template <int Channels, bool Ramping>
+    void mix(float* const* io, int processed_channels, int num_samples,
+        double wet_level, double dry_level, double target_level);
 
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FlexDelayAudioProcessor)
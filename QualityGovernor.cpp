@@ -0,0 +1,64 @@
+/*
+  ==============================================================================
+
+    QualityGovernor.cpp
+    Trades interpolation quality for CPU when processBlock runs late.
+
+  ==============================================================================
+*/
+
+#include "QualityGovernor.h"
+
+void QualityGovernor::set_ceiling(InterpolationQuality q) {
+    if (q == ceiling_) return;
+
+    ceiling_ = q;
+
+    // The user asked for something different, so start again from there.
+    quality_ = q;
+    over_count_ = 0;
+    under_count_ = 0;
+}
+
+InterpolationQuality QualityGovernor::update(double elapsed_sec, double budget_sec, bool non_realtime) {
+
+    if (non_realtime) {
+        // Nobody is waiting on an offline render, so always use the best we have.
+        quality_ = InterpolationQuality::SINC;
+        over_count_ = 0;
+        under_count_ = 0;
+        return quality_;
+    }
+
+    if (quality_ > ceiling_) {
+        // Coming back from an offline render.
+        quality_ = ceiling_;
+    }
+
+    if (budget_sec <= 0.0) return quality_;
+
+    auto load = elapsed_sec / budget_sec;
+
+    if (load > threshold_) {
+        under_count_ = 0;
+        if (++over_count_ >= DOWNGRADE_BLOCKS && quality_ > InterpolationQuality::NONE) {
+            quality_ = InterpolationQuality(int(quality_) - 1);
+            ++downgrade_count_;
+            over_count_ = 0;
+        }
+    }
+    else if (load < threshold_ * UPGRADE_FRACTION) {
+        over_count_ = 0;
+        if (++under_count_ >= UPGRADE_BLOCKS && quality_ < ceiling_) {
+            quality_ = InterpolationQuality(int(quality_) + 1);
+            under_count_ = 0;
+        }
+    }
+    else {
+        // In the dead band - stay put.
+        over_count_ = 0;
+        under_count_ = 0;
+    }
+
+    return quality_;
+}
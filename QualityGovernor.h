@@ -0,0 +1,49 @@
+/*
+  ==============================================================================
+
+    QualityGovernor.h
+    Trades interpolation quality for CPU when processBlock runs late.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "Interpolation.h"
+
+class QualityGovernor {
+public:
+
+    // The best tier the governor may use while running in real time.
+    void set_ceiling(InterpolationQuality q);
+
+    // Step down when a block takes more than this fraction of its real-time
+    // budget. Step back up only once the load has stayed below
+    // threshold * UPGRADE_FRACTION for a while.
+    void set_threshold(double fraction) { threshold_ = fraction; }
+    double get_threshold() const { return threshold_; }
+
+    // Feed in how long the last block took and how long it was allowed to take.
+    // Returns the tier to use for the next block. Only feed blocks in which
+    // the interpolation kernel ran; the tier makes no difference to the rest.
+    InterpolationQuality update(double elapsed_sec, double budget_sec, bool non_realtime);
+
+    InterpolationQuality get_quality() const { return quality_; }
+
+    // How many times we have had to step down. Handy when looking at a session
+    // that sounded worse than expected.
+    int get_downgrade_count() const { return downgrade_count_; }
+
+private:
+    static constexpr int DOWNGRADE_BLOCKS = 2;
+    static constexpr int UPGRADE_BLOCKS = 200;
+    static constexpr double UPGRADE_FRACTION = 0.5;
+
+    InterpolationQuality ceiling_ = InterpolationQuality::CUBIC;
+    InterpolationQuality quality_ = InterpolationQuality::CUBIC;
+    double threshold_ = 0.75;
+
+    int over_count_ = 0;
+    int under_count_ = 0;
+    int downgrade_count_ = 0;
+};
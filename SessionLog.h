@@ -0,0 +1,101 @@
+/*
+  ==============================================================================
+
+    SessionLog.h
+    On-disk format written by SessionRecorder and read by the replayer.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstdint>
+
+// A log is a FileHeader followed by records. Every record is a RecordHeader
+// and then `size` bytes of payload, so a reader can skip types it doesn't
+// know. Everything is written in the native byte order of the machine that
+// made the recording. Payloads only ever grow at the end; a reader fills
+// what an older writer left out with zeros, so that needs no new VERSION.
+namespace session_log {
+
+    constexpr char MAGIC[4] = { 'F', 'D', 'L', 'G' };
+    constexpr uint32_t VERSION = 1;
+
+    enum RecordType : uint32_t {
+        PREPARE = 1,    // PreparePayload
+        PARAMS  = 2,    // ParamsPayload - written when any of them change
+        BLOCK   = 3,    // BlockPayload, then the input audio if FLAG_AUDIO is set
+        OUTPUT  = 4,    // AudioPayload, then the processed audio
+        GAP     = 5,    // no payload - records were dropped before this one
+        NETWORK = 6,    // NetworkPayload, then node_count NetworkNodes and edge_count
+                        // NetworkEdges - the DelayGraph the next PREPARE compiles
+    };
+
+    // BlockPayload flags
+    constexpr int32_t FLAG_AUDIO = 1;
+    constexpr int32_t FLAG_NON_REALTIME = 2;
+
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+    };
+
+    struct RecordHeader {
+        uint32_t type;
+        uint32_t size;
+    };
+
+    struct PreparePayload {
+        double sample_rate;
+        int32_t max_block;
+        int32_t kernel_level;   // KernelLevel + 1, or 0 if not known (older logs)
+        int32_t input_channels; // 0 if not known (older logs)
+        int32_t output_channels;
+    };
+
+    struct ParamsPayload {
+        double delay_msec;
+        double wet_mix;
+        double output_level;
+    };
+
+    // Audio is stored channel after channel, num_samples floats each.
+    struct BlockPayload {
+        int32_t num_samples;
+        int32_t num_channels;
+        int32_t interpolation;  // the tier actually used for the block
+        int32_t flags;
+    };
+
+    struct AudioPayload {
+        int32_t num_samples;
+        int32_t num_channels;
+    };
+
+    // DelayGraph's description, node for node in NodeId order.
+    struct NetworkPayload {
+        int32_t node_count;
+        int32_t edge_count;
+    };
+
+    struct NetworkNode {
+        double param;
+        int32_t type;           // DelayGraph::NodeType
+        int32_t source;         // TAP only
+    };
+
+    struct NetworkEdge {
+        int32_t from;
+        int32_t to;
+    };
+
+    static_assert(sizeof(FileHeader) == 8, "unexpected padding");
+    static_assert(sizeof(RecordHeader) == 8, "unexpected padding");
+    static_assert(sizeof(PreparePayload) == 24, "unexpected padding");
+    static_assert(sizeof(ParamsPayload) == 24, "unexpected padding");
+    static_assert(sizeof(BlockPayload) == 16, "unexpected padding");
+    static_assert(sizeof(AudioPayload) == 8, "unexpected padding");
+    static_assert(sizeof(NetworkPayload) == 8, "unexpected padding");
+    static_assert(sizeof(NetworkNode) == 16, "unexpected padding");
+    static_assert(sizeof(NetworkEdge) == 8, "unexpected padding");
+}
@@ -0,0 +1,296 @@
+/*
+  ==============================================================================
+
+    SessionRecorder.cpp
+    Debug capture of everything processBlock saw, so a glitch can be
+    replayed outside the host. See SessionLog.h for the format.
+
+  ==============================================================================
+*/
+
+#include "SessionRecorder.h"
+#include "Kernels.h"
+
+#include <cstring>
+
+namespace {
+    // The kernels decide the last bits of the output, so the replayer needs
+    // to know which ones ran.
+    int32_t recorded_kernel_level() {
+        return int32_t(get_kernel_level()) + 1;
+    }
+
+    // A NETWORK payload: the counts, then the nodes, then the edges.
+    std::vector<char> network_payload(const DelayGraph& network) {
+        auto& nodes = network.get_nodes();
+        auto& edges = network.get_edges();
+
+        session_log::NetworkPayload header { int32_t(nodes.size()), int32_t(edges.size()) };
+        std::vector<char> bytes(sizeof(header)
+            + sizeof(session_log::NetworkNode) * nodes.size()
+            + sizeof(session_log::NetworkEdge) * edges.size());
+
+        auto* dest = bytes.data();
+        auto write = [&](const void* data, size_t size) {
+            std::memcpy(dest, data, size);
+            dest += size;
+        };
+
+        write(&header, sizeof(header));
+        for (auto& n : nodes) {
+            session_log::NetworkNode node { n.param, int32_t(n.type), int32_t(n.source) };
+            write(&node, sizeof(node));
+        }
+        for (auto& e : edges) {
+            session_log::NetworkEdge edge { int32_t(e.from), int32_t(e.to) };
+            write(&edge, sizeof(edge));
+        }
+        return bytes;
+    }
+}
+
+// Empties the ring into the file every few milliseconds.
+class SessionRecorder::Writer : public juce::Thread {
+public:
+    Writer(SessionRecorder& owner) : juce::Thread("FlexDelay session recorder"), owner_(owner) {}
+
+    void run() override {
+        while (!threadShouldExit()) {
+            owner_.drain();
+            wait(5);
+        }
+    }
+
+private:
+    SessionRecorder& owner_;
+};
+
+// Marks the producer as busy for stop(). Taken before looking at the flag,
+// so that stop() either sees us or we see it.
+class SessionRecorder::ScopedUse {
+public:
+    ScopedUse(SessionRecorder& owner) : owner_(owner) {
+        ++owner_.audio_users_;
+        active = owner_.is_recording();
+    }
+    ~ScopedUse() { --owner_.audio_users_; }
+
+    bool active;
+
+private:
+    SessionRecorder& owner_;
+};
+
+SessionRecorder::SessionRecorder() {
+}
+
+SessionRecorder::~SessionRecorder() {
+    stop();
+}
+
+bool SessionRecorder::start(const juce::File& file, bool include_audio, double sample_rate, int max_block,
+    int input_channels, int output_channels, const DelayGraph* network) {
+    stop();
+
+    file.deleteFile();
+    auto stream = std::make_unique<juce::FileOutputStream>(file);
+    if (!stream->openedOk()) {
+        DBG("SessionRecorder - could not open " << file.getFullPathName());
+        return false;
+    }
+
+    session_log::FileHeader header;
+    std::memcpy(header.magic, session_log::MAGIC, sizeof(header.magic));
+    header.version = session_log::VERSION;
+    stream->write(&header, sizeof(header));
+
+    if (network != nullptr) {
+        auto payload = network_payload(*network);
+        session_log::RecordHeader record { session_log::NETWORK, uint32_t(payload.size()) };
+        stream->write(&record, sizeof(record));
+        stream->write(payload.data(), payload.size());
+    }
+
+    if (sample_rate > 0.0) {
+        session_log::PreparePayload payload { sample_rate, int32_t(max_block), recorded_kernel_level(),
+            int32_t(input_channels), int32_t(output_channels) };
+        session_log::RecordHeader record { session_log::PREPARE, uint32_t(sizeof(payload)) };
+        stream->write(&record, sizeof(record));
+        stream->write(&payload, sizeof(payload));
+    }
+
+    ring_.assign(RING_BYTES, 0);
+    fifo_.reset();
+    stream_ = std::move(stream);
+    include_audio_ = include_audio;
+    pending_gap_ = false;
+    block_dropped_ = false;
+    have_params_ = false;
+    dropped_ = 0;
+
+    writer_ = std::make_unique<Writer>(*this);
+    writer_->startThread();
+
+    recording_ = true;
+
+    DBG("SessionRecorder - capturing to " << file.getFullPathName());
+    return true;
+}
+
+void SessionRecorder::stop() {
+    if (!writer_) return;
+
+    recording_ = false;
+
+    // Let a processBlock that saw us as recording finish its record.
+    while (audio_users_ > 0) {
+        juce::Thread::sleep(1);
+    }
+
+    writer_->stopThread(1000);
+    writer_.reset();
+
+    drain();
+    stream_->flush();
+    stream_.reset();
+
+    if (dropped_.load() > 0) {
+        DBG("SessionRecorder - dropped " << dropped_.load() << " records");
+    }
+}
+
+bool SessionRecorder::push(session_log::RecordType type, const Span* spans, int count) {
+
+    int total = int(sizeof(session_log::RecordHeader));
+    for (int i = 0; i < count; ++i) total += spans[i].bytes;
+
+    if (pending_gap_) {
+        // Say that something went missing before we write anything else.
+        if (fifo_.getFreeSpace() < total + int(sizeof(session_log::RecordHeader))) {
+            ++dropped_;
+            return false;
+        }
+        pending_gap_ = false;
+        push(session_log::GAP, nullptr, 0);
+    }
+
+    int start1, size1, start2, size2;
+    fifo_.prepareToWrite(total, start1, size1, start2, size2);
+    if (size1 + size2 < total) {
+        pending_gap_ = true;
+        ++dropped_;
+        return false;
+    }
+
+    // Copy into the (up to) two regions the fifo handed us.
+    auto write_bytes = [&](const void* data, int bytes) {
+        auto src = static_cast<const char*>(data);
+        auto first = juce::jmin(bytes, size1);
+        std::memcpy(ring_.data() + start1, src, size_t(first));
+        start1 += first;
+        size1 -= first;
+        if (bytes > first) {
+            std::memcpy(ring_.data() + start2, src + first, size_t(bytes - first));
+            start2 += bytes - first;
+        }
+    };
+
+    session_log::RecordHeader header { uint32_t(type), uint32_t(total - int(sizeof(session_log::RecordHeader))) };
+    write_bytes(&header, sizeof(header));
+    for (int i = 0; i < count; ++i) {
+        write_bytes(spans[i].data, spans[i].bytes);
+    }
+
+    fifo_.finishedWrite(total);
+    return true;
+}
+
+bool SessionRecorder::push_audio(session_log::RecordType type, const void* payload, int payload_bytes,
+        const juce::AudioBuffer<float>& buffer, bool with_audio) {
+
+    Span spans[1 + MAX_CHANNELS];
+    int count = 0;
+    spans[count++] = { payload, payload_bytes };
+
+    if (with_audio) {
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel) {
+            spans[count++] = { buffer.getReadPointer(channel), int(sizeof(float)) * buffer.getNumSamples() };
+        }
+    }
+
+    return push(type, spans, count);
+}
+
+void SessionRecorder::record_prepare(double sample_rate, int max_block, int input_channels, int output_channels) {
+    ScopedUse use(*this);
+    if (!use.active) return;
+
+    session_log::PreparePayload payload { sample_rate, int32_t(max_block), recorded_kernel_level(),
+        int32_t(input_channels), int32_t(output_channels) };
+    Span spans[1] = { { &payload, int(sizeof(payload)) } };
+    push(session_log::PREPARE, spans, 1);
+}
+
+void SessionRecorder::record_network(const DelayGraph& network) {
+    ScopedUse use(*this);
+    if (!use.active) return;
+
+    auto payload = network_payload(network);
+    Span spans[1] = { { payload.data(), int(payload.size()) } };
+    push(session_log::NETWORK, spans, 1);
+}
+
+void SessionRecorder::record_params(double delay_msec, double wet_mix, double output_level) {
+    ScopedUse use(*this);
+    if (!use.active) return;
+
+    session_log::ParamsPayload payload { delay_msec, wet_mix, output_level };
+    if (!have_params_ || std::memcmp(&payload, &last_params_, sizeof(payload)) != 0) {
+        Span spans[1] = { { &payload, int(sizeof(payload)) } };
+        if (push(session_log::PARAMS, spans, 1)) {
+            last_params_ = payload;
+            have_params_ = true;
+        }
+        else {
+            // Make sure we try again next block.
+            have_params_ = false;
+        }
+    }
+}
+
+void SessionRecorder::record_block_start(const juce::AudioBuffer<float>& buffer, InterpolationQuality quality, bool non_realtime) {
+    ScopedUse use(*this);
+    if (!use.active) return;
+
+    auto with_audio = include_audio_ && buffer.getNumChannels() <= MAX_CHANNELS;
+
+    session_log::BlockPayload payload;
+    payload.num_samples = buffer.getNumSamples();
+    payload.num_channels = buffer.getNumChannels();
+    payload.interpolation = int32_t(quality);
+    payload.flags = (with_audio ? session_log::FLAG_AUDIO : 0)
+        | (non_realtime ? session_log::FLAG_NON_REALTIME : 0);
+
+    block_dropped_ = !push_audio(session_log::BLOCK, &payload, sizeof(payload), buffer, with_audio);
+}
+
+void SessionRecorder::record_block_end(const juce::AudioBuffer<float>& buffer) {
+    ScopedUse use(*this);
+    if (!use.active) return;
+
+    // An output without its block is no use to anyone.
+    if (include_audio_ && !block_dropped_ && buffer.getNumChannels() <= MAX_CHANNELS) {
+        session_log::AudioPayload payload { buffer.getNumSamples(), buffer.getNumChannels() };
+        push_audio(session_log::OUTPUT, &payload, sizeof(payload), buffer, true);
+    }
+}
+
+void SessionRecorder::drain() {
+    int start1, size1, start2, size2;
+    fifo_.prepareToRead(fifo_.getNumReady(), start1, size1, start2, size2);
+
+    if (size1 > 0) stream_->write(ring_.data() + start1, size_t(size1));
+    if (size2 > 0) stream_->write(ring_.data() + start2, size_t(size2));
+
+    fifo_.finishedRead(size1 + size2);
+}
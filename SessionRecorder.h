@@ -0,0 +1,89 @@
+/*
+  ==============================================================================
+
+    SessionRecorder.h
+    Debug capture of everything processBlock saw, so a glitch can be
+    replayed outside the host. See SessionLog.h for the format.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SessionLog.h"
+#include "DelayGraph.h"
+#include "Interpolation.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class SessionRecorder {
+public:
+    SessionRecorder();
+    ~SessionRecorder();
+
+    // Message thread only. The capture is only bit-exact to replay if it is
+    // started before the first prepareToPlay. If it is started mid-session,
+    // pass the current sample rate, block size, channel counts and network
+    // so the log still opens with a PREPARE record.
+    bool start(const juce::File& file, bool include_audio, double sample_rate = 0.0, int max_block = 0,
+        int input_channels = 0, int output_channels = 0, const DelayGraph* network = nullptr);
+    void stop();
+
+    bool is_recording() const { return recording_; }
+
+    // The rest are called from prepareToPlay / processBlock. None of them
+    // allocate, lock or touch the file; if the ring is full the record is
+    // dropped and a GAP is written in its place once there is room.
+    void record_prepare(double sample_rate, int max_block, int input_channels, int output_channels);
+    // Except this one, which builds the record on the heap - prepareToPlay
+    // only, before the compile() it describes.
+    void record_network(const DelayGraph& network);
+    void record_params(double delay_msec, double wet_mix, double output_level);
+    void record_block_start(const juce::AudioBuffer<float>& buffer, InterpolationQuality quality, bool non_realtime);
+    void record_block_end(const juce::AudioBuffer<float>& buffer);
+
+    int get_dropped_count() const { return dropped_.load(); }
+
+private:
+    class Writer;
+    class ScopedUse;
+
+    static constexpr int RING_BYTES = 1 << 22;
+    static constexpr int MAX_CHANNELS = 8;
+
+    struct Span {
+        const void* data;
+        int bytes;
+    };
+
+    juce::AbstractFifo fifo_ { RING_BYTES };
+    std::vector<char> ring_;
+
+    std::unique_ptr<juce::FileOutputStream> stream_;
+    std::unique_ptr<Writer> writer_;
+
+    std::atomic<bool> recording_ { false };
+    std::atomic<int> audio_users_ { 0 };
+    std::atomic<int> dropped_ { 0 };
+
+    bool include_audio_ = false;
+
+    // Producer side only (prepareToPlay / processBlock).
+    bool pending_gap_ = false;
+    bool block_dropped_ = false;
+    session_log::ParamsPayload last_params_ {};
+    bool have_params_ = false;
+
+    // Writes one whole record or nothing.
+    bool push(session_log::RecordType type, const Span* spans, int count);
+    bool push_audio(session_log::RecordType type, const void* payload, int payload_bytes,
+        const juce::AudioBuffer<float>& buffer, bool with_audio);
+
+    // Consumer side - the writer thread, or stop() once it has gone.
+    void drain();
+
+    JUCE_DECLARE_NON_COPYABLE(SessionRecorder)
+};
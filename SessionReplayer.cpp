@@ -0,0 +1,382 @@
+/*
+  ==============================================================================
+
+    SessionReplayer.cpp
+    Headless replay of a log written by SessionRecorder. Drives
+    prepareToPlay/processBlock with the recorded sequence, times each block
+    and, if the audio was captured, checks the output is bit-exact.
+
+    Usage: FlexDelayReplayer <log file> [--quiet] [--verify-kernels]
+
+    The kernels the recording ran with are used again if this CPU has
+    them; if not, the replay says so, since the output can then differ in
+    the last bits.
+
+    --verify-kernels runs the scalar kernels alongside the ones picked for
+    this CPU and reports how far apart they got (see Kernels.h).
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "Kernels.h"
+#include "PluginProcessor.h"
+#include "SessionLog.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+    template <typename T>
+    T read_payload(const std::vector<char>& payload) {
+        T value {};
+        std::memcpy(&value, payload.data(), juce::jmin(sizeof(T), payload.size()));
+        return value;
+    }
+
+    // Copy channel-after-channel floats from the payload (after `offset`
+    // bytes of header) into the buffer. Returns false, without copying
+    // anything, if the payload is too short to hold them all.
+    bool read_audio(const std::vector<char>& payload, size_t offset, juce::AudioBuffer<float>& buffer) {
+        auto bytes = sizeof(float) * size_t(buffer.getNumSamples());
+        if (payload.size() < offset + bytes * size_t(buffer.getNumChannels())) return false;
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel) {
+            std::memcpy(buffer.getWritePointer(channel), payload.data() + offset + bytes * size_t(channel), bytes);
+        }
+        return true;
+    }
+
+    // Give the processor the channel layout the recording had. Returns
+    // false if it would not take it.
+    bool apply_layout(FlexDelayAudioProcessor& processor, int inputs, int outputs, double sample_rate, int max_block) {
+        juce::AudioProcessor::BusesLayout layout;
+        layout.inputBuses.add(juce::AudioChannelSet::canonicalChannelSet(inputs));
+        layout.outputBuses.add(juce::AudioChannelSet::canonicalChannelSet(outputs));
+        if (!processor.setBusesLayout(layout)) {
+            // Not a layout the buses accept - set the counts directly, as a
+            // host that doesn't negotiate layouts would.
+            processor.setPlayConfigDetails(inputs, outputs, sample_rate, max_block);
+        }
+        return processor.getTotalNumInputChannels() == inputs && processor.getTotalNumOutputChannels() == outputs;
+    }
+
+    // Read a NETWORK payload back into node specs and edges. Returns false
+    // if it is short or describes nodes DelayGraph can't make.
+    bool read_network(const std::vector<char>& payload, std::vector<DelayGraph::NodeSpec>& nodes,
+            std::vector<DelayGraph::Edge>& edges) {
+        auto header = read_payload<session_log::NetworkPayload>(payload);
+        if (header.node_count < 2 || header.edge_count < 0) return false;
+
+        auto node_count = size_t(header.node_count);
+        auto edge_count = size_t(header.edge_count);
+        if (payload.size() < sizeof(header) + sizeof(session_log::NetworkNode) * node_count
+                + sizeof(session_log::NetworkEdge) * edge_count) {
+            return false;
+        }
+
+        auto* src = payload.data() + sizeof(header);
+        nodes.clear();
+        for (size_t i = 0; i < node_count; ++i, src += sizeof(session_log::NetworkNode)) {
+            session_log::NetworkNode n;
+            std::memcpy(&n, src, sizeof(n));
+            if (n.type < int32_t(DelayGraph::NodeType::INPUT) || n.type > int32_t(DelayGraph::NodeType::FILTER)) return false;
+            nodes.push_back({ DelayGraph::NodeType(n.type), n.param, DelayGraph::NodeId(n.source) });
+        }
+        edges.clear();
+        for (size_t i = 0; i < edge_count; ++i, src += sizeof(session_log::NetworkEdge)) {
+            session_log::NetworkEdge e;
+            std::memcpy(&e, src, sizeof(e));
+            edges.push_back({ DelayGraph::NodeId(e.from), DelayGraph::NodeId(e.to) });
+        }
+
+        // clear() makes these two first, and nothing else can add them.
+        for (size_t i = 0; i < node_count; ++i) {
+            auto is_end = nodes[i].type == DelayGraph::NodeType::INPUT || nodes[i].type == DelayGraph::NodeType::OUTPUT;
+            if (is_end != (i < 2)) return false;
+        }
+        return nodes[0].type == DelayGraph::NodeType::INPUT && nodes[1].type == DelayGraph::NodeType::OUTPUT;
+    }
+
+    bool same_network(const DelayGraph& network, const std::vector<DelayGraph::NodeSpec>& nodes,
+            const std::vector<DelayGraph::Edge>& edges) {
+        auto& have_nodes = network.get_nodes();
+        auto& have_edges = network.get_edges();
+        if (have_nodes.size() != nodes.size() || have_edges.size() != edges.size()) return false;
+
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            auto& a = have_nodes[i];
+            auto& b = nodes[i];
+            if (a.type != b.type || a.param != b.param || a.source != b.source) return false;
+        }
+        for (size_t i = 0; i < edges.size(); ++i) {
+            if (have_edges[i].from != edges[i].from || have_edges[i].to != edges[i].to) return false;
+        }
+        return true;
+    }
+
+    // Describe the recorded network again, node for node, so the NodeIds
+    // come out the same.
+    void rebuild_network(DelayGraph& network, const std::vector<DelayGraph::NodeSpec>& nodes,
+            const std::vector<DelayGraph::Edge>& edges) {
+        network.clear();
+        for (size_t i = 2; i < nodes.size(); ++i) {
+            auto& n = nodes[i];
+            switch (n.type) {
+            case DelayGraph::NodeType::DELAY:   network.add_delay(n.param); break;
+            case DelayGraph::NodeType::TAP:     network.add_tap(n.source, n.param); break;
+            case DelayGraph::NodeType::GAIN:    network.add_gain(n.param); break;
+            case DelayGraph::NodeType::FILTER:  network.add_filter(n.param); break;
+            default:                            break;  // INPUT and OUTPUT come from clear()
+            }
+        }
+        for (auto& e : edges) network.connect(e.from, e.to);
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    if (argc < 2) {
+        std::printf("usage: %s <log file> [--quiet] [--verify-kernels]\n", argv[0]);
+        return 2;
+    }
+
+    auto quiet = false;
+    auto verify_kernels = false;
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--quiet") == 0) quiet = true;
+        if (std::strcmp(argv[i], "--verify-kernels") == 0) verify_kernels = true;
+    }
+
+    juce::File log_file = juce::File::getCurrentWorkingDirectory().getChildFile(argv[1]);
+    juce::FileInputStream in(log_file);
+    if (!in.openedOk()) {
+        std::printf("could not open %s\n", argv[1]);
+        return 2;
+    }
+
+    session_log::FileHeader header;
+    if (in.read(&header, sizeof(header)) != int(sizeof(header))
+            || std::memcmp(header.magic, session_log::MAGIC, sizeof(header.magic)) != 0
+            || header.version != session_log::VERSION) {
+        std::printf("%s is not a FlexDelay session log\n", argv[1]);
+        return 2;
+    }
+
+    FlexDelayAudioProcessor processor;
+
+    // Replay the tiers that were recorded rather than re-deciding them.
+    processor.governor_threshold = 0.0;
+
+    // The processor picked the kernels when it was built. Each PREPARE
+    // switches to the ones the recording used, if this machine has them.
+    const auto best_level = get_kernel_level();
+    if (verify_kernels) set_kernel_verify(true);
+    if (!quiet) std::printf("%s kernels\n", kernel_level_name(best_level));
+
+    juce::AudioBuffer<float> buffer;
+    juce::AudioBuffer<float> expected;
+    juce::MidiBuffer midi;
+    std::vector<char> payload;
+    std::vector<DelayGraph::NodeSpec> network_nodes;
+    std::vector<DelayGraph::Edge> network_edges;
+
+    double sample_rate = 0.0;
+    int channels = 0;
+    int block_count = 0;
+    int mismatch_count = 0;
+    int skipped_count = 0;
+    int gap_count = 0;
+    int unchecked_count = 0;
+    bool network_known = true;
+    bool prepared = false;
+    bool block_ok = false;
+    double total_sec = 0.0;
+    double worst_load = 0.0;
+    int worst_block = -1;
+
+    session_log::RecordHeader record;
+    while (in.read(&record, sizeof(record)) == int(sizeof(record))) {
+
+        payload.resize(record.size);
+        if (record.size > 0 && in.read(payload.data(), int(record.size)) != int(record.size)) {
+            std::printf("log is truncated\n");
+            break;
+        }
+
+        switch (record.type) {
+
+        case session_log::PREPARE: {
+            auto p = read_payload<session_log::PreparePayload>(payload);
+            sample_rate = p.sample_rate;
+
+            if (p.kernel_level > 0 && p.kernel_level <= KERNEL_LEVEL_COUNT) {
+                auto recorded = KernelLevel(p.kernel_level - 1);
+                auto level = select_kernels(juce::jmin(recorded, best_level));
+                if (level != recorded) {
+                    std::printf("recorded with %s kernels but replaying with %s, the output may not match\n",
+                        kernel_level_name(recorded), kernel_level_name(level));
+                }
+                else if (!quiet) {
+                    std::printf("%s kernels, as recorded\n", kernel_level_name(level));
+                }
+            }
+            else if (p.kernel_level != 0) {
+                std::printf("recorded with unknown kernels (%d), the output may not match\n", p.kernel_level);
+            }
+
+            // Older logs don't have the layout; they were made with the
+            // default one.
+            if (p.input_channels > 0 && p.output_channels > 0
+                    && !apply_layout(processor, p.input_channels, p.output_channels, p.sample_rate, p.max_block)) {
+                std::printf("recorded with %d in / %d out but replaying with %d / %d\n", p.input_channels, p.output_channels,
+                    processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+            }
+
+            processor.setRateAndBufferSizeDetails(p.sample_rate, p.max_block);
+            processor.prepareToPlay(p.sample_rate, p.max_block);
+            // The host's buffer has room for whichever side has more channels.
+            channels = juce::jmax(processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+            buffer.setSize(channels, p.max_block);
+            expected.setSize(channels, p.max_block);
+            prepared = true;
+            if (!quiet) {
+                std::printf("prepare: %.1f Hz, %d samples max, %d in / %d out\n", p.sample_rate, p.max_block,
+                    processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+            }
+            break;
+        }
+
+        case session_log::PARAMS: {
+            auto p = read_payload<session_log::ParamsPayload>(payload);
+            processor.target_delay_msec = p.delay_msec;
+            processor.target_wet_mix = p.wet_mix;
+            processor.target_main_output_level = p.output_level;
+            break;
+        }
+
+        case session_log::BLOCK: {
+            auto b = read_payload<session_log::BlockPayload>(payload);
+            block_ok = false;
+
+            if (!prepared || b.num_channels != channels || b.num_samples < 0) {
+                std::printf("block %d: skipped (%d channels, %d samples, not prepared for it)\n",
+                    block_count, b.num_channels, b.num_samples);
+                ++skipped_count;
+                ++block_count;
+                break;
+            }
+
+            buffer.setSize(b.num_channels, b.num_samples, false, false, true);
+            if (b.flags & session_log::FLAG_AUDIO) {
+                if (!read_audio(payload, sizeof(b), buffer)) {
+                    std::printf("block %d: skipped (%d bytes is too short for its audio)\n", block_count, int(payload.size()));
+                    ++skipped_count;
+                    ++block_count;
+                    break;
+                }
+            }
+            else {
+                buffer.clear();
+            }
+
+            processor.interpolation_quality = InterpolationQuality(b.interpolation);
+
+            auto start = juce::Time::getHighResolutionTicks();
+            processor.processBlock(buffer, midi);
+            auto elapsed = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+            auto load = (sample_rate > 0.0) ? elapsed / (b.num_samples / sample_rate) : 0.0;
+            total_sec += elapsed;
+            if (load > worst_load) {
+                worst_load = load;
+                worst_block = block_count;
+            }
+
+            if (!quiet) {
+                std::printf("block %d: %d samples, %s, %.1f us, %.1f%% of budget\n", block_count, b.num_samples,
+                    interpolation_quality_name(InterpolationQuality(b.interpolation)), elapsed * 1e6, load * 100.0);
+            }
+
+            block_ok = true;
+            ++block_count;
+            break;
+        }
+
+        case session_log::OUTPUT: {
+            auto o = read_payload<session_log::AudioPayload>(payload);
+            if (!block_ok || o.num_channels != buffer.getNumChannels() || o.num_samples != buffer.getNumSamples()) break;
+            if (!network_known) {
+                ++unchecked_count;
+                break;
+            }
+
+            expected.setSize(o.num_channels, o.num_samples, false, false, true);
+            if (!read_audio(payload, sizeof(o), expected)) {
+                std::printf("block %d: recorded output is short, not compared\n", block_count - 1);
+                break;
+            }
+
+            double max_dev = 0.0;
+            bool exact = true;
+            for (int channel = 0; channel < o.num_channels; ++channel) {
+                auto* got = buffer.getReadPointer(channel);
+                auto* want = expected.getReadPointer(channel);
+                if (std::memcmp(got, want, sizeof(float) * size_t(o.num_samples)) != 0) exact = false;
+                for (int i = 0; i < o.num_samples; ++i) {
+                    max_dev = juce::jmax(max_dev, double(std::abs(got[i] - want[i])));
+                }
+            }
+
+            if (!exact) {
+                ++mismatch_count;
+                std::printf("block %d: output differs, max deviation %g\n", block_count - 1, max_dev);
+            }
+            break;
+        }
+
+        case session_log::NETWORK: {
+            // Only touch the description if it changed. An unchanged one
+            // lets the next compile keep its delay contents, as it did when
+            // this was recorded.
+            network_known = read_network(payload, network_nodes, network_edges);
+            if (!network_known) {
+                std::printf("block %d: delay network record is unreadable, output is not compared from here\n", block_count);
+            }
+            else if (!same_network(processor.get_network(), network_nodes, network_edges)) {
+                rebuild_network(processor.get_network(), network_nodes, network_edges);
+                if (!quiet) {
+                    std::printf("network: %d nodes, %d edges\n", int(network_nodes.size()), int(network_edges.size()));
+                }
+            }
+            break;
+        }
+
+        case session_log::GAP:
+            ++gap_count;
+            std::printf("block %d: records were dropped here, replay is no longer exact\n", block_count);
+            break;
+
+        default:
+            // Something newer than us - skip it.
+            break;
+        }
+    }
+
+    std::printf("%d blocks, %.3f ms total, worst block %d at %.1f%% of budget\n",
+        block_count, total_sec * 1000.0, worst_block, worst_load * 100.0);
+    if (gap_count > 0) std::printf("%d gaps in the log\n", gap_count);
+    if (skipped_count > 0) std::printf("%d blocks could not be replayed\n", skipped_count);
+    if (unchecked_count > 0) std::printf("%d blocks were not compared, the delay network was not known\n", unchecked_count);
+    std::printf("%d blocks differed from the recording\n", mismatch_count);
+    if (verify_kernels) {
+        std::printf("%s kernels, max deviation from scalar %g\n",
+            kernel_level_name(get_kernel_level()), get_kernel_max_deviation());
+    }
+
+    // A block that couldn't be replayed, or ran with the wrong network,
+    // wasn't checked either.
+    return (mismatch_count == 0 && skipped_count == 0 && unchecked_count == 0) ? 0 : 1;
+}
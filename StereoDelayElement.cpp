@@ -10,9 +10,57 @@
 
 #include "StereoDelayElement.h"
 
+#include <algorithm>
+#include <cstdlib>
+
+StereoDelayElement::StereoDelayElement() {
+    for (auto& d : delays) {
+        allocator_.watch(d.get_exchange());
+    }
+    allocator_.start();
+}
+
+void StereoDelayElement::prepare(double sample_rate, int max_block) {
+    // Make room at the new rate first, so that a rate change below can
+    // resample the lines in place.
+    auto room = size_t(std::max(0, int(sample_rate * .001 * std::max(MAX_DELAY_MSEC, target_msec_))));
+    for (auto& d : delays) {
+        d.reserve(room);
+        d.prepare(size_t(max_block));
+    }
+
+    if (!initialised_) {
+        recalc_delays(sample_rate, target_msec_);
+    }
+    else {
+        set_sample_rate(sample_rate);
+    }
+}
+
 void StereoDelayElement::set_sample_rate(double sample_rate) {
-    if (sample_rate != sample_rate_) {
-        recalc_delays(sample_rate, delay_msec_[0]);
+    if (!initialised_) {
+        recalc_delays(sample_rate, target_msec_);
+        return;
+    }
+
+    if (sample_rate == sample_rate_) return;
+
+    // Both lines get the same treatment, so if they matched before they
+    // still do.
+    unlink();
+
+    auto old_rate = sample_rate_;
+    sample_rate_ = sample_rate;
+
+    for (int c = 0; c < CHANNEL_COUNT; ++c) {
+        // Scale what the line actually holds, which may be mid glide.
+        auto msec = double(delays[c].get_delay()) * 1000.0 / old_rate;
+        auto new_samples = msec_to_sample(msec);
+        delays[c].resample_to(size_t(std::max(0, new_samples)));
+
+        // Rounding can leave us a sample off the target. Let do_delay
+        // glide the rest of the way.
+        delay_msec_[c] = (new_samples == msec_to_sample(target_msec_)) ? target_msec_ : msec;
     }
 }
 
@@ -27,38 +75,127 @@ void StereoDelayElement::change_delay(double new_msec) {
     target_msec_ = new_msec;
 }
 
+void StereoDelayElement::set_interpolation(InterpolationQuality q) {
+    for (auto& d : delays) {
+        d.set_interpolation(q);
+    }
+}
+
 constexpr double DELTA_FACTOR = 0.3;
 
-void StereoDelayElement::do_delay(int channel, const std::vector<double>& input, std::vector<double>& output) {
+bool StereoDelayElement::do_delay(int channel, const double* input, double* output, size_t count) {
+
+    auto resampled = false;
+    if (channel == 0) grow_lines();
 
     if (target_msec_ != delay_msec_[channel]) {
 
-        auto old_msec = delay_msec_[channel];
-        auto old_delay_samples = msec_to_sample(old_msec);
+        // Work from what the line actually has. It may have been held short
+        // while it waited for a bigger buffer.
+        auto old_delay_samples = int(delays[channel].get_delay());
+
+        auto target_samples = msec_to_sample(target_msec_);
+        auto new_delay_samples = target_samples;
 
-        auto new_msec = target_msec_;
-        auto new_delay_samples = msec_to_sample(new_msec);
-        
         auto delta = new_delay_samples - old_delay_samples;
-        if (std::abs(delta) > (DELTA_FACTOR * input.size())) {
+        if (std::abs(delta) > (DELTA_FACTOR * count)) {
             int sign = (delta > 0) - (delta < 0);
-            new_delay_samples = old_delay_samples + int(DELTA_FACTOR * input.size() * sign);
-            new_msec = sample_to_msec(new_delay_samples);
+            new_delay_samples = old_delay_samples + int(DELTA_FACTOR * count * sign);
         }
-        delay_msec_[channel] = new_msec;
 
-        delays[channel].do_delay(input, output, new_delay_samples);
+        // Hold at what both lines can fit until grow_lines() gets them more.
+        auto room = int(std::min(delays[0].get_capacity(), delays[1].get_capacity()));
+        new_delay_samples = std::min(new_delay_samples, room);
+
+        resampled = delays[channel].do_delay(input, output, count, new_delay_samples);
+
+        auto actual = int(delays[channel].get_delay());
+        delay_msec_[channel] = (actual == target_samples) ? target_msec_ : sample_to_msec(actual);
     }
     else {
-        delays[channel].do_delay(input, output, -1);
+        delays[channel].do_delay(input, output, count, -1);
     }
+
+    if (channel == CHANNEL_COUNT - 1) {
+        // The lines grow together, so they shouldn't drift apart on
+        // identical input, but check rather than assume.
+        auto same_setup = delays[0].get_delay() == delays[1].get_delay()
+            && delay_msec_[0] == delay_msec_[1]
+            && delays[0].get_interpolation_state() == delays[1].get_interpolation_state();
+
+        if (!same_setup) {
+            states_match_ = false;
+        }
+        else if (!states_match_ && identical_run_ >= delays[0].get_delay()) {
+            // Both lines now hold nothing but samples that were the same on
+            // both inputs, so they match again.
+            states_match_ = true;
+        }
+    }
+
+    return resampled;
 }
 
 
+bool StereoDelayElement::link_channels(bool inputs_identical, size_t num_samples) {
+
+    if (!inputs_identical) {
+        unlink();
+        identical_run_ = 0;
+        states_match_ = false;
+        ++split_blocks_;
+        return false;
+    }
+
+    // Only link if this block can't grow delays[0] past what delays[1] can
+    // hold, or we wouldn't be able to copy it back across later.
+    auto target_samples = size_t(std::max(0, msec_to_sample(target_msec_)));
+    auto room = std::min(delays[0].get_capacity(), delays[1].get_capacity());
+
+    if (states_match_ && target_samples <= room) {
+        linked_ = true;
+        ++linked_blocks_;
+        return true;
+    }
+
+    unlink();
+    identical_run_ += num_samples;
+    ++split_blocks_;
+    return false;
+}
+
+void StereoDelayElement::grow_lines() {
+    auto target = size_t(std::max(0, msec_to_sample(target_msec_)));
+    if (target <= std::min(delays[0].get_capacity(), delays[1].get_capacity())) return;
+
+    // Ask on behalf of both before giving up, so the allocator works on
+    // them together.
+    auto ready = true;
+    for (auto& d : delays) {
+        if (!d.can_grow_to(target)) ready = false;
+    }
+    if (!ready) return;
+
+    for (auto& d : delays) {
+        d.ensure_capacity(target);
+    }
+}
+
+void StereoDelayElement::unlink() {
+    if (!linked_) return;
+
+    linked_ = false;
+    delays[1].copy_state_from(delays[0]);
+    delay_msec_[1] = delay_msec_[0];
+}
+
 void StereoDelayElement::recalc_delays(double new_rate, double new_msec) {
 
     // Hard reset the delay lines to the new (possibly the same) values.
 
+    unlink();
+    initialised_ = true;
+
     sample_rate_ = new_rate;
 
     for (auto& x : delay_msec_) {
@@ -67,8 +204,14 @@ void StereoDelayElement::recalc_delays(double new_rate, double new_msec) {
 
     auto delay_samples = new_rate * new_msec * 0.001;
 
+    // set_delay leaves a line alone if it is already that long.
+    bool cleared = true;
     for (auto& d : delays) {
+        if (d.get_delay() == size_t(delay_samples)) cleared = false;
         d.set_delay(delay_samples);
     }
+    if (cleared) {
+        states_match_ = true;
+    }
 
 }
@@ -13,27 +13,84 @@
 #include "DelayLine.h"
 
 #include <array>
+#include <atomic>
 
 class StereoDelayElement {
 public:
-    // These two force a hard reset on the delay lines. All data is cleared.
+    // The longest delay the editor offers. prepare() makes room for it up
+    // front, so a delay change in that range never waits on the allocator
+    // and what comes out doesn't depend on thread timing.
+    static constexpr double MAX_DELAY_MSEC = 2000.0;
+
+    StereoDelayElement();
+
+    // Call from prepareToPlay. The first time through this sets the lines
+    // to the change_delay target. After that it keeps what is in them: a new
+    // sample rate stretches the contents to match (see set_sample_rate), and
+    // a new target is glided to by do_delay as usual. Reserves room for
+    // MAX_DELAY_MSEC and sizes the per-block scratch space too. Not for the
+    // audio thread.
+    void prepare(double sample_rate, int max_block);
+
+    // Forces a hard reset on the delay lines. All data is cleared.
     void set_delay(double msec, double sample_rate = -1);
+
+    // Keeps the delay in msec and resamples what is in the lines to the new
+    // rate. May allocate, so not for the audio thread.
     void set_sample_rate(double sample_rate);
 
     // This tries to do something graceful with the change
     void change_delay(double new_msec);
 
-    void do_delay(int channel, const std::vector<double>& input, std::vector<double>& output);
+    // count samples from input to output, which must not overlap. Returns
+    // true if the line was resampled this block (see DelayLine::do_delay).
+    bool do_delay(int channel, const double* input, double* output, size_t count);
+
+    void set_interpolation(InterpolationQuality q);
+
+    // Call once per block, before do_delay. If the two inputs are identical
+    // and so are the two delay lines, returns true - the caller should then
+    // only run channel 0 and copy the result to channel 1. The second line
+    // is brought back up to date the first time the inputs differ, so the
+    // output is bit for bit what running both channels would give.
+    bool link_channels(bool inputs_identical, size_t num_samples);
+
+    // How often link_channels said yes / no.
+    int get_linked_block_count() const { return linked_blocks_; }
+    int get_split_block_count() const { return split_blocks_; }
 
 private:
     static constexpr int CHANNEL_COUNT = 2;
 
     std::array<DelayLine, CHANNEL_COUNT> delays;
+
+    // Grows the delay lines off the audio thread. Declared after them so
+    // that it is stopped before they go away.
+    BufferAllocator allocator_;
     double sample_rate_ = 44100.0;
     double delay_msec_[CHANNEL_COUNT];
+    // False until the lines have been set up once.
+    bool initialised_ = false;
 
     double target_msec_ = 200.0;
 
+    // True while both lines hold the same samples and settings.
+    bool states_match_ = true;
+    // True while delays[1] is behind because we have only been running delays[0].
+    bool linked_ = false;
+    // How many samples in a row both inputs have been identical. Once it
+    // covers the whole delay, the lines must match again.
+    size_t identical_run_ = 0;
+
+    std::atomic<int> linked_blocks_ { 0 };
+    std::atomic<int> split_blocks_ { 0 };
+
+    void unlink();
+
+    // Past MAX_DELAY_MSEC the lines have to grow. Both swap in their bigger
+    // buffers on the same block, once both have arrived.
+    void grow_lines();
+
     void recalc_delays(double new_rate, double new_msec);
     int msec_to_sample(double msec) { return int(sample_rate_ * .001 * msec); }
     double sample_to_msec(int samples) { return double(samples) * 1000.0 / sample_rate_; }
@@ -0,0 +1,207 @@
+/*
+  ==============================================================================
+
+    Tests.cpp
+    Checks for the parts of the DSP code that talk to other threads. They
+    are meant to be run under ThreadSanitizer as well as plainly - configure
+    with FLEXDELAY_TSAN=ON - since a race shows up there whether or not it
+    happens to corrupt anything on the day.
+
+    Usage: FlexDelayTests [test ...]
+
+    With no arguments every test runs. Exits non-zero if any fail.
+
+  ==============================================================================
+*/
+
+#include "BufferExchange.h"
+#include "DelayLine.h"
+#include "StereoDelayElement.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    //==============================================================================
+    // exchange - DelayLine growing through a running BufferAllocator, over
+    // and over. Every growth is a take() on this thread racing the
+    // allocator's service() on its own. can_grow_to() has to keep its
+    // promise, and the line's contents have to come through intact.
+
+    bool exchange() {
+        constexpr int ROUNDS = 3;
+        constexpr size_t LINES = 4;
+        constexpr size_t START = 64;
+        constexpr size_t LIMIT = 1 << 18;
+
+        for (int round = 0; round < ROUNDS; ++round) {
+            std::vector<std::unique_ptr<DelayLine>> lines;
+            BufferAllocator allocator;
+            for (size_t k = 0; k < LINES; ++k) {
+                lines.push_back(std::make_unique<DelayLine>(START));
+                allocator.watch(lines.back()->get_exchange());
+            }
+            allocator.start();
+
+            // Each line runs as the audio thread would: a sample out and a
+            // sample in, counting up, so it always holds the last START
+            // numbers.
+            std::vector<double> next(LINES, 0.0);
+            auto step = [&](size_t k) {
+                lines[k]->get_next();
+                lines[k]->add(next[k]);
+                next[k] += 1.0;
+            };
+
+            for (size_t k = 0; k < LINES; ++k) {
+                for (size_t i = 0; i < START; ++i) step(k);
+            }
+
+            for (size_t size = START; size < LIMIT; size = size * 5 / 4 + 1) {
+                for (size_t k = 0; k < LINES; ++k) {
+                    // Ask first and swap in only once it is there, the way
+                    // StereoDelayElement::grow_lines() does.
+                    while (!lines[k]->can_grow_to(size)) {
+                        step(k);
+                        std::this_thread::yield();
+                    }
+                    if (!lines[k]->ensure_capacity(size)) {
+                        std::printf("can_grow_to(%zu) said yes, ensure_capacity said no\n", size);
+                        return false;
+                    }
+                    step(k);
+
+                    auto& line = *lines[k];
+                    if (line.tap(0) != next[k] - 1.0 || line.tap(START - 1) != next[k] - double(START)) {
+                        std::printf("line lost its contents growing to %zu samples\n", size);
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    //==============================================================================
+    // grow_past_reserve - sweep a StereoDelayElement's delay well past what
+    // prepare() reserves, so both lines have to grow through the allocator
+    // while audio runs. The two channels get the same input and must stay
+    // identical, and an impulse sent once the sweep is done has to come out
+    // at the final delay.
+
+    bool grow_past_reserve() {
+        constexpr double SAMPLE_RATE = 48000.0;
+        constexpr int BLOCK = 256;
+        constexpr double FINAL_MSEC = 3.0 * StereoDelayElement::MAX_DELAY_MSEC;
+
+        StereoDelayElement element;
+        element.change_delay(500.0);
+        element.prepare(SAMPLE_RATE, BLOCK);
+
+        // This runs far faster than real time. Sleeping a little each block
+        // gives the allocator the chances it would get alongside a real
+        // audio callback.
+        auto pace = [] { std::this_thread::sleep_for(std::chrono::milliseconds(1)); };
+
+        std::vector<double> in(BLOCK), out[2] = { std::vector<double>(BLOCK), std::vector<double>(BLOCK) };
+        auto run_block = [&] {
+            for (int channel = 0; channel < 2; ++channel) {
+                element.do_delay(channel, in.data(), out[channel].data(), size_t(BLOCK));
+            }
+            return std::memcmp(out[0].data(), out[1].data(), sizeof(double) * size_t(BLOCK)) == 0;
+        };
+
+        long block = 0;
+        for (auto msec = 500.0; msec <= FINAL_MSEC; msec += 250.0) {
+            element.change_delay(msec);
+            for (int i = 0; i < 20; ++i, ++block) {
+                for (int n = 0; n < BLOCK; ++n) {
+                    in[size_t(n)] = std::sin(0.01 * double(block * BLOCK + n));
+                }
+                if (!run_block()) {
+                    std::printf("channels differ at block %ld, %.0f ms\n", block, msec);
+                    return false;
+                }
+                pace();
+            }
+        }
+
+        // Let the last change settle and the line empty out, then time an
+        // impulse through it.
+        const auto final_samples = long(SAMPLE_RATE * FINAL_MSEC * 0.001);
+        const auto limit = 4 * final_samples / BLOCK + 100;
+
+        std::fill(in.begin(), in.end(), 0.0);
+        for (long b = 0; b < limit; ++b) {
+            run_block();
+            if (b < 200) pace();
+        }
+
+        long found = -1;
+        in[0] = 1.0;
+        for (long b = 0; b < limit && found < 0; ++b) {
+            if (!run_block()) {
+                std::printf("channels differ after the sweep\n");
+                return false;
+            }
+            in[0] = 0.0;
+
+            for (int n = 0; n < BLOCK; ++n) {
+                if (std::abs(out[0][size_t(n)]) > 0.5) found = b * BLOCK + n;
+            }
+        }
+
+        if (std::labs(found - final_samples) > 1) {
+            std::printf("impulse came out after %ld samples, expected %ld\n", found, final_samples);
+            return false;
+        }
+        return true;
+    }
+
+    //==============================================================================
+    struct Test {
+        const char* name;
+        bool (*run)();
+    };
+
+    const Test tests[] = {
+        { "exchange", exchange },
+        { "grow_past_reserve", grow_past_reserve },
+    };
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<const Test*> chosen;
+
+    for (int i = 1; i < argc; ++i) {
+        auto* found = std::find_if(std::begin(tests), std::end(tests),
+            [&](const Test& t) { return std::strcmp(t.name, argv[i]) == 0; });
+
+        if (found == std::end(tests)) {
+            std::printf("usage: %s [test ...]\ntests:", argv[0]);
+            for (auto& t : tests) std::printf(" %s", t.name);
+            std::printf("\n");
+            return 2;
+        }
+        chosen.push_back(found);
+    }
+
+    if (chosen.empty()) {
+        for (auto& t : tests) chosen.push_back(&t);
+    }
+
+    int failed = 0;
+    for (auto* t : chosen) {
+        auto ok = t->run();
+        std::printf("%s: %s\n", t->name, ok ? "ok" : "FAILED");
+        if (!ok) ++failed;
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <cmath>
+
 
 struct utils {
     